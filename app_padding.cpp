@@ -23,7 +23,8 @@ static void usage(void)
         "-o, --output           output file path, default full_firmware.bin\n"
         "-v, --version          firmware version, default unknown\n"
         "-c, --commit           firmware commit hash, default unknown\n"
-        "-p, --params           params bin file path\n");
+        "-p, --params           params bin file path, up to 17 KB, the last page of\n"
+        "                       PARAMS is reserved for the upgrade journal\n");
 }
 
 static void _close(int sig)
@@ -49,6 +50,7 @@ struct padding_def
     string path;
     int fd;
     uint32_t size;
+    uint32_t image_size; // bytes of the loaded binary rounded up to a flash word
     vector<uint8_t> data;
 };
 
@@ -148,9 +150,11 @@ int main(int argc, char *const *argv)
             close(pads[i].fd);
             return -1;
         }
-        if ((uint32_t)st.st_size > pads[i].size)
+        // the last page of PARAMS is the upgrade journal of the device
+        uint32_t max_size = i == PARAMS_INDEX ? (uint32_t)PARTITION_SIZE_USER_PARAMS : pads[i].size;
+        if ((uint32_t)st.st_size > max_size)
         {
-            printf("%s size %ld exceed partition size %u\n", pads[i].path.c_str(), st.st_size, pads[i].size);
+            printf("%s size %ld exceed partition size %u\n", pads[i].path.c_str(), st.st_size, max_size);
             close(pads[i].fd);
             return -1;
         }
@@ -163,6 +167,7 @@ int main(int argc, char *const *argv)
             return -1;
         }
         close(pads[i].fd);
+        pads[i].image_size = ((uint32_t)read_bytes + 3) & ~3U;
         printf("load %s size %ld bytes\n", pads[i].path.c_str(), read_bytes);
     }
     BootFromInfo_p bootfrom_info = (BootFromInfo_p)pads[BOOTFROM_INDEX].data.data();
@@ -186,9 +191,9 @@ int main(int argc, char *const *argv)
         sscanf(version_str.c_str(), "v%d.%d.%d", &major, &minor, &patch);
         appa_info->version = ((major & 0xFF) << 16) | ((minor & 0xFF) << 8) | (patch & 0xFF);
     }
-    appa_info->size_bytes = pads[APP_A_INDEX].size;
+    appa_info->size_bytes = pads[APP_A_INDEX].image_size;
     appa_info->commit_hash = commit_str == "unknown" ? 0 : strtoul(commit_str.c_str(), NULL, 16);
-    appa_info->app_checksum = crc32_calculate(pads[APP_A_INDEX].data.data(), pads[APP_A_INDEX].size, 0);
+    appa_info->app_checksum = crc32_calculate(pads[APP_A_INDEX].data.data(), appa_info->size_bytes, 0);
     time_t now = time(NULL);
     localtime_r(&now, &tm);
     appa_info->compile_timestamp = (uint32_t)mktime(&tm);
@@ -196,9 +201,9 @@ int main(int argc, char *const *argv)
     AppInfo_p appb_info = (AppInfo_p)pads[APP_B_INFO_INDEX].data.data();
     appb_info->magicNumber = PARTITION_MAGIC_NUMBER;
     appb_info->version = appa_info->version;
-    appb_info->size_bytes = pads[APP_B_INDEX].size;
+    appb_info->size_bytes = pads[APP_B_INDEX].image_size;
     appb_info->commit_hash = appa_info->commit_hash;
-    appb_info->app_checksum = crc32_calculate(pads[APP_B_INDEX].data.data(), pads[APP_B_INDEX].size, 0);
+    appb_info->app_checksum = crc32_calculate(pads[APP_B_INDEX].data.data(), appb_info->size_bytes, 0);
     appb_info->compile_timestamp = appa_info->compile_timestamp;
 
     int out_fd = open(output_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
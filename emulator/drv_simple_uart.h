@@ -0,0 +1,12 @@
+#ifndef EMULATOR_DRV_SIMPLE_UART_H
+#define EMULATOR_DRV_SIMPLE_UART_H
+
+#include <stdint.h>
+
+/* the baudrate calls of the UART driver, implemented on the pseudo terminal by emulator.c */
+
+int gd32_uart_set_baudrate(void *handle, uint32_t baudrate);
+
+int gd32_uart_tx_drain(void *handle, uint32_t timeout_ms);
+
+#endif // EMULATOR_DRV_SIMPLE_UART_H
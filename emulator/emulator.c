@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <queue.h>
+#include "xlink_upgrade.h"
+#include "xlink_port_posix.h"
+#include "xlink_port_stdlib.h"
+#include "emulator.h"
+#include "drv_simple_uart.h"
+
+/*
+ * Runs src/upgrade.c on the host behind a pseudo terminal, so the upgrade
+ * tool can be pointed at it instead of a board. The line is throttled to the
+ * configured baudrate in both directions, 10 bits per byte for 8N1.
+ */
+
+#define EMULATOR_TX_FRAMES 16 // like TX_DMA_DATA_MAX_CNT of the uart driver
+
+int upgrade_init(xlink_context_p context);
+int baudrate_init(xlink_context_p context, void *uart_handle);
+void baudrate_rx_activity(void);
+
+static int pty_fd = -1;
+static volatile uint32_t baudrate = 115200;
+static uint32_t reset_baudrate = 115200; // what the UART comes up with after a restart
+static bool unthrottled;
+static QueueHandle_t tx_frames;
+static volatile int tx_pending; // frames queued or still on the line
+
+struct emulator_line
+{
+    struct timespec free_at; // when the last byte queued on the wire has been sent
+};
+
+static struct emulator_line rx_line;
+static struct emulator_line tx_line;
+
+/* sleep for the wire time of bytes more bytes, queued behind what is already on the line */
+static void line_transfer(struct emulator_line *line, size_t bytes)
+{
+    struct timespec now;
+    uint64_t ns;
+
+    if (unthrottled)
+    {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (line->free_at.tv_sec < now.tv_sec ||
+        (line->free_at.tv_sec == now.tv_sec && line->free_at.tv_nsec < now.tv_nsec))
+    {
+        line->free_at = now;
+    }
+    ns = (uint64_t)bytes * 10 * 1000000000ULL / baudrate + (uint64_t)line->free_at.tv_nsec;
+    line->free_at.tv_sec += (time_t)(ns / 1000000000ULL);
+    line->free_at.tv_nsec = (long)(ns % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &line->free_at, NULL) == EINTR)
+    {
+    }
+}
+
+static xlink_frame_t *emulator_frame_send_alloc(void *transport_handle, uint16_t needed)
+{
+    (void)transport_handle;
+    xlink_frame_t *frame = (xlink_frame_t *)malloc(sizeof(xlink_frame_t));
+    if (frame == NULL)
+    {
+        return NULL;
+    }
+    frame->buffer = (uint8_t *)malloc(needed);
+    if (frame->buffer == NULL)
+    {
+        free(frame);
+        return NULL;
+    }
+    frame->size = needed;
+    frame->next = NULL;
+    frame->prev = NULL;
+    return frame;
+}
+
+/* frames are sent by tx_task, the caller does not wait for the line like the uart DMA */
+static int emulator_transport_send(void *transport_handle, xlink_frame_t *frame)
+{
+    (void)transport_handle;
+    __atomic_add_fetch(&tx_pending, 1, __ATOMIC_SEQ_CST);
+    if (xQueueSend(tx_frames, &frame, 0) != pdPASS)
+    {
+        __atomic_sub_fetch(&tx_pending, 1, __ATOMIC_SEQ_CST);
+        free(frame->buffer);
+        free(frame);
+        return -1;
+    }
+    return 0;
+}
+
+static void tx_task(void *parameters)
+{
+    (void)parameters;
+    for (;;)
+    {
+        xlink_frame_t *frame;
+        xQueueReceive(tx_frames, &frame, portMAX_DELAY);
+        line_transfer(&tx_line, frame->size);
+        for (size_t sent = 0; sent < frame->size;)
+        {
+            ssize_t len = write(pty_fd, frame->buffer + sent, frame->size - sent);
+            if (len < 0 && errno != EINTR)
+            {
+                break;
+            }
+            sent += len > 0 ? (size_t)len : 0;
+        }
+        free(frame->buffer);
+        free(frame);
+        __atomic_sub_fetch(&tx_pending, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* the pseudo terminal ignores its line settings, the new rate only changes the throttling */
+int gd32_uart_set_baudrate(void *handle, uint32_t rate)
+{
+    (void)handle;
+    if (rate == 0)
+    {
+        return -1;
+    }
+    baudrate = rate;
+    printf("baudrate %u\n", rate);
+    fflush(stdout);
+    return 0;
+}
+
+int gd32_uart_tx_drain(void *handle, uint32_t timeout_ms)
+{
+    (void)handle;
+    for (uint32_t waited = 0; __atomic_load_n(&tx_pending, __ATOMIC_SEQ_CST) > 0; waited++)
+    {
+        if (waited >= timeout_ms)
+        {
+            return -1;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    return 0;
+}
+
+void emulator_restart(void)
+{
+    /* the flash file keeps its contents, the session state of upgrade.c is not reset */
+    baudrate = reset_baudrate;
+    printf("restart requested\n");
+    fflush(stdout);
+}
+
+static int pty_open(const char *link_path)
+{
+    struct termios param;
+    const char *name;
+    int slave_fd;
+
+    pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_fd < 0 || grantpt(pty_fd) != 0 || unlockpt(pty_fd) != 0 || (name = ptsname(pty_fd)) == NULL)
+    {
+        perror("pty");
+        return -1;
+    }
+    /* keep the slave open so the master does not see EIO between host tool runs */
+    slave_fd = open(name, O_RDWR | O_NOCTTY);
+    if (slave_fd < 0 || tcgetattr(slave_fd, &param) != 0)
+    {
+        perror(name);
+        return -1;
+    }
+    cfmakeraw(&param);
+    tcsetattr(slave_fd, TCSANOW, &param);
+
+    if (link_path)
+    {
+        unlink(link_path);
+        if (symlink(name, link_path) != 0)
+        {
+            perror(link_path);
+            return -1;
+        }
+    }
+    printf("device: %s\n", link_path ? link_path : name);
+    fflush(stdout);
+    return 0;
+}
+
+static void usage(void)
+{
+    printf(
+        "Usage: device_emulator -f /path/to/flash.bin\n"
+        "-h, --help             display this help and exit\n"
+        "-f, --flash            flash image file, created erased if missing\n"
+        "-l, --link             symlink to create for the pseudo terminal\n"
+        "-b, --baudrate         line speed in bit/s, default 115200, 0 unthrottled,\n"
+        "                       SetBaudrate changes it unless unthrottled\n"
+        "-e, --erase-us         page erase time in microseconds, default 0\n"
+        "-p, --program-us       word program time in microseconds, default 0\n");
+}
+
+int main(int argc, char *const *argv)
+{
+    static xlink_port_api_t port = {
+        .malloc_fn = xlink_stdlib_malloc,
+        .free_fn = xlink_stdlib_free,
+        .mutex_create_fn = xlink_posix_mutex_create,
+        .mutex_delete_fn = xlink_posix_mutex_delete,
+        .mutex_lock_fn = xlink_posix_mutex_lock,
+        .mutex_unlock_fn = xlink_posix_mutex_unlock,
+        .transport_send_fn = emulator_transport_send,
+        .frame_send_alloc_fn = emulator_frame_send_alloc,
+    };
+
+    static const char short_options[] = "hf:l:b:e:p:";
+    static struct option long_options[] = {
+        {"help", 0, 0, 'h'},
+        {"flash", 1, 0, 'f'},
+        {"link", 1, 0, 'l'},
+        {"baudrate", 1, 0, 'b'},
+        {"erase-us", 1, 0, 'e'},
+        {"program-us", 1, 0, 'p'},
+        {0, 0, 0, 0}};
+
+    const char *flash_path = NULL;
+    const char *link_path = NULL;
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, short_options, long_options, &option_index)) != -1)
+    {
+        switch (c)
+        {
+        case 'f':
+            flash_path = optarg;
+            break;
+        case 'l':
+            link_path = optarg;
+            break;
+        case 'b':
+            baudrate = (uint32_t)strtoul(optarg, NULL, 0);
+            unthrottled = baudrate == 0;
+            reset_baudrate = baudrate;
+            break;
+        case 'e':
+            emulator_erase_us = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            emulator_program_us = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+        default:
+            usage();
+            return c == 'h' ? 0 : -1;
+        }
+    }
+    if (flash_path == NULL)
+    {
+        usage();
+        return -1;
+    }
+
+    if (emulator_flash_open(flash_path) != 0 || pty_open(link_path) != 0)
+    {
+        return 1;
+    }
+
+    tx_frames = xQueueCreate(EMULATOR_TX_FRAMES, sizeof(xlink_frame_t *));
+    xlink_context_p ctx = xlink_context_create(&port, NULL);
+    if (tx_frames == NULL || ctx == NULL || upgrade_init(ctx) != 0 || baudrate_init(ctx, NULL) != 0 ||
+        xTaskCreate(tx_task, "tx", configMINIMAL_STACK_SIZE, NULL, tskIDLE_PRIORITY + 2U, NULL) != pdPASS)
+    {
+        printf("emulator init failed\n");
+        return 1;
+    }
+
+    for (;;)
+    {
+        uint8_t rx_buffer[256];
+        ssize_t read_bytes = read(pty_fd, rx_buffer, sizeof(rx_buffer));
+        if (read_bytes <= 0)
+        {
+            if (read_bytes < 0 && errno != EINTR && errno != EAGAIN)
+            {
+                perror("pty read");
+                return 1;
+            }
+            continue;
+        }
+        line_transfer(&rx_line, (size_t)read_bytes);
+        /* the CPU does not run while the FMC is busy */
+        taskENTER_CRITICAL();
+        taskEXIT_CRITICAL();
+        if (xlink_process_rx_buffer(ctx, rx_buffer, (size_t)read_bytes) > 0)
+        {
+            baudrate_rx_activity();
+        }
+    }
+}
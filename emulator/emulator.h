@@ -0,0 +1,22 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <stdint.h>
+
+/*
+ * Host build of the device upgrade path. The flash lives in a file that is
+ * mapped read only at its device address, so device sources read it through
+ * plain pointers and can only change it through onchip_flash_port.
+ */
+
+/* map the flash image, a missing or short file is extended with erased bytes */
+int emulator_flash_open(const char *path);
+
+/* FMC busy time in microseconds, 0 does not model it */
+extern uint32_t emulator_erase_us;   // per page erase
+extern uint32_t emulator_program_us; // per word program
+
+/* NVIC_SystemReset() of the device */
+void emulator_restart(void);
+
+#endif // EMULATOR_H
@@ -0,0 +1,10 @@
+#ifndef EMULATOR_GD32C10X_H
+#define EMULATOR_GD32C10X_H
+
+/* the parts of the GD32C10x firmware library used by the emulated sources */
+
+#include "emulator.h"
+
+#define NVIC_SystemReset() emulator_restart()
+
+#endif // EMULATOR_GD32C10X_H
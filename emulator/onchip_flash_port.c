@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include "partition.h"
+#include "onchip_flash_port.h"
+#include "emulator.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define FLASH_BASE PARTITION_ADDRESS_BOOTLOADER
+#define FLASH_SIZE (PARTITION_ADDRESS_PARAMS + PARTITION_SIZE_PARAMS - PARTITION_ADDRESS_BOOTLOADER)
+
+uint32_t emulator_erase_us;
+uint32_t emulator_program_us;
+
+static int flash_fd = -1;
+
+int emulator_flash_open(const char *path)
+{
+    static uint8_t blank[PAGE_SIZE];
+    struct stat st;
+    void *flash;
+
+    flash_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (flash_fd < 0 || fstat(flash_fd, &st) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+    memset(blank, 0xFF, sizeof(blank));
+    for (off_t offset = st.st_size; offset < FLASH_SIZE;)
+    {
+        size_t len = FLASH_SIZE - offset < PAGE_SIZE ? FLASH_SIZE - offset : PAGE_SIZE;
+        if (pwrite(flash_fd, blank, len, offset) != (ssize_t)len)
+        {
+            perror(path);
+            return -1;
+        }
+        offset += len;
+    }
+
+    /* a kernel without MAP_FIXED_NOREPLACE may place the mapping elsewhere */
+    flash = mmap((void *)(uintptr_t)FLASH_BASE, FLASH_SIZE, PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, flash_fd, 0);
+    if (flash != (void *)(uintptr_t)FLASH_BASE)
+    {
+        fprintf(stderr, "can not map the flash at 0x%08x\n", FLASH_BASE);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stores go to the file, the shared mapping sees them at once. The busy time
+ * is spent inside the critical section like the FMC command on the device,
+ * the xlink task waits for it the way code fetches stall on the real part.
+ */
+static void flash_busy(uint32_t us)
+{
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (long)(us % 1000000) * 1000,
+    };
+    while (us && nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+static int flash_offset(uint32_t address, uint32_t size, off_t *offset)
+{
+    if (address < FLASH_BASE || address - FLASH_BASE > FLASH_SIZE || size > FLASH_SIZE - (address - FLASH_BASE))
+    {
+        return -1;
+    }
+    *offset = address - FLASH_BASE;
+    return 0;
+}
+
+static int fmc_erase_one_page(uint32_t page_address)
+{
+    static uint8_t blank[PAGE_SIZE];
+    off_t offset;
+    int ret;
+
+    if (page_address % PAGE_SIZE != 0 || flash_offset(page_address, PAGE_SIZE, &offset) != 0)
+    {
+        fprintf(stderr, "flash: erase of invalid page 0x%08x\n", page_address);
+        return -1;
+    }
+    memset(blank, 0xFF, sizeof(blank));
+
+    taskENTER_CRITICAL();
+    ret = pwrite(flash_fd, blank, PAGE_SIZE, offset) == PAGE_SIZE ? 0 : -1;
+    flash_busy(emulator_erase_us);
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+static int fmc_program_one_word(uint32_t address, uint32_t data)
+{
+    off_t offset;
+    int ret;
+
+    if (address % 4 != 0 || flash_offset(address, 4, &offset) != 0)
+    {
+        fprintf(stderr, "flash: program of invalid address 0x%08x\n", address);
+        return -1;
+    }
+    /* the FMC only programs a word that reads back erased */
+    if (*(const volatile uint32_t *)(uintptr_t)address != 0xFFFFFFFF)
+    {
+        fprintf(stderr, "flash: program of word 0x%08x that is not erased\n", address);
+        return -1;
+    }
+
+    taskENTER_CRITICAL();
+    ret = pwrite(flash_fd, &data, 4, offset) == 4 ? 0 : -1;
+    flash_busy(emulator_program_us);
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+int fmc_erase_pages(uint32_t page_address, uint32_t page_num)
+{
+    uint32_t EraseCounter;
+
+    for (EraseCounter = 0; EraseCounter < page_num; EraseCounter++)
+    {
+        if (fmc_erase_one_page(page_address + (PAGE_SIZE * EraseCounter)) != 0)
+        {
+            return -1;
+        }
+
+        if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+        {
+            taskYIELD();
+        }
+    }
+
+    return 0;
+}
+
+int fmc_erase_pages_check(uint32_t page_address, uint32_t page_num)
+{
+    uint32_t i;
+
+    uint32_t *ptrd = (uint32_t *)(uintptr_t)page_address;
+
+    for (i = 0; i < page_num * (PAGE_SIZE >> 2); i++)
+    {
+        if (0xFFFFFFFF != (*ptrd))
+        {
+            return -1;
+        }
+        else
+        {
+            ptrd++;
+        }
+    }
+    return 0;
+}
+
+uint32_t fmc_program_data(uint32_t address, void *data, uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < size / 4; i++)
+    {
+        if (fmc_program_one_word(address, *(uint32_t *)data) != 0)
+        {
+            break;
+        }
+        data = (void *)((uint8_t *)data + 4);
+        address += 4;
+    }
+
+    return address;
+}
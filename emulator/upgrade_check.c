@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <FreeRTOS.h>
+#include "xlink_upgrade.h"
+#include "xlink_port_posix.h"
+#include "xlink_port_stdlib.h"
+#include "partition.h"
+#include "emulator.h"
+
+/*
+ * Host check of a plain upgrade session of src/upgrade.c on the emulated
+ * flash. The chunks do not end on word boundaries and are sent in orders
+ * that leave many partial words open at once; rejected chunks are resent in
+ * the same order like the upgrade tool does, and the session must finalize
+ * with the image programmed. Device and host xlink contexts are wired back
+ * to back, every handler runs on the caller of xlink_process_rx_buffer. A
+ * PAGE_ERASE session whose chunks straddle pages must be refused.
+ */
+
+#define CHECK_CHUNK_SIZE XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN
+#define CHECK_CHUNKS 64
+#define CHECK_IMAGE_SIZE (CHECK_CHUNKS * CHECK_CHUNK_SIZE - 2) // the tail word is partial too
+#define CHECK_ADDRESS PARTITION_ADDRESS_APP_B_INFO
+#define CHECK_MAX_ROUNDS 16
+
+int upgrade_init(xlink_context_p context);
+
+static xlink_context_p device_ctx;
+static xlink_context_p host_ctx;
+static int start_accepted;
+static int finalize_success;
+static uint8_t chunk_accepted[CHECK_CHUNKS];
+
+void emulator_restart(void)
+{
+}
+
+static xlink_frame_t *check_frame_send_alloc(void *transport_handle, uint16_t needed)
+{
+    (void)transport_handle;
+    xlink_frame_t *frame = (xlink_frame_t *)malloc(sizeof(xlink_frame_t));
+    if (frame == NULL)
+    {
+        return NULL;
+    }
+    frame->buffer = (uint8_t *)malloc(needed);
+    if (frame->buffer == NULL)
+    {
+        free(frame);
+        return NULL;
+    }
+    frame->size = needed;
+    frame->next = NULL;
+    frame->prev = NULL;
+    return frame;
+}
+
+/* the transport handle points at the context on the other end */
+static int check_transport_send(void *transport_handle, xlink_frame_t *frame)
+{
+    xlink_process_rx_buffer(*(xlink_context_p *)transport_handle, frame->buffer, frame->size);
+    free(frame->buffer);
+    free(frame);
+    return 0;
+}
+
+static int start_response_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+{
+    (void)comp_id;
+    (void)msg_id;
+    (void)payload_len;
+    (void)user_data;
+    start_accepted = ((const xlink_upgrade_start_firmware_upgrade_response_t *)payload)->accepted;
+    return 0;
+}
+
+static int chunk_response_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+{
+    (void)comp_id;
+    (void)msg_id;
+    (void)payload_len;
+    (void)user_data;
+    const xlink_upgrade_firmware_chunk_response_t *response = (const xlink_upgrade_firmware_chunk_response_t *)payload;
+    if (response->offset < CHECK_CHUNKS)
+    {
+        chunk_accepted[response->offset] = response->accepted;
+    }
+    return 0;
+}
+
+static int finalize_response_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+{
+    (void)comp_id;
+    (void)msg_id;
+    (void)payload_len;
+    (void)user_data;
+    finalize_success = ((const xlink_upgrade_finalize_firmware_upgrade_response_t *)payload)->success;
+    return 0;
+}
+
+/* send every chunk in order[] until all are accepted, returns the number of rejections or -1 */
+static int run_session(const char *name, const uint8_t *image, const uint32_t *order)
+{
+    int rejected = 0;
+    int round;
+
+    start_accepted = 0;
+    finalize_success = 0;
+    memset(chunk_accepted, 0, sizeof(chunk_accepted));
+    xlink_upgrade_start_firmware_upgrade_send(host_ctx, CHECK_ADDRESS, CHECK_IMAGE_SIZE, CHECK_CHUNK_SIZE, XLINK_UPGRADE_FLAG_NONE, 0);
+    if (!start_accepted)
+    {
+        printf("%-12s start rejected\n", name);
+        return -1;
+    }
+    for (round = 0; round < CHECK_MAX_ROUNDS; round++)
+    {
+        int pending = 0;
+        for (uint32_t i = 0; i < CHECK_CHUNKS; i++)
+        {
+            uint32_t offset = order[i];
+            uint32_t pos = offset * CHECK_CHUNK_SIZE;
+            uint32_t len = CHECK_IMAGE_SIZE - pos < CHECK_CHUNK_SIZE ? CHECK_IMAGE_SIZE - pos : CHECK_CHUNK_SIZE;
+            if (chunk_accepted[offset])
+            {
+                continue;
+            }
+            xlink_upgrade_firmware_chunk_send(host_ctx, offset, &image[pos], (uint8_t)len);
+            if (!chunk_accepted[offset])
+            {
+                rejected++;
+                pending++;
+            }
+        }
+        if (pending == 0)
+        {
+            break;
+        }
+    }
+    xlink_upgrade_finalize_firmware_upgrade_send(host_ctx, crc32_calculate(image, CHECK_IMAGE_SIZE, 0));
+    if (round == CHECK_MAX_ROUNDS || !finalize_success ||
+        memcmp((const void *)(uintptr_t)CHECK_ADDRESS, image, CHECK_IMAGE_SIZE) != 0)
+    {
+        printf("%-12s FAILED after %d rounds, %d rejected, finalize %s\n",
+               name, round + 1, rejected, finalize_success ? "ok" : "failed");
+        return -1;
+    }
+    printf("%-12s ok, %d rounds, %d chunks rejected and resent\n", name, round + 1, rejected);
+    return rejected;
+}
+
+int main(void)
+{
+    static xlink_port_api_t port = {
+        .malloc_fn = xlink_stdlib_malloc,
+        .free_fn = xlink_stdlib_free,
+        .mutex_create_fn = xlink_posix_mutex_create,
+        .mutex_delete_fn = xlink_posix_mutex_delete,
+        .mutex_lock_fn = xlink_posix_mutex_lock,
+        .mutex_unlock_fn = xlink_posix_mutex_unlock,
+        .transport_send_fn = check_transport_send,
+        .frame_send_alloc_fn = check_frame_send_alloc,
+    };
+    char flash_path[] = "/tmp/upgrade_check_XXXXXX";
+    static uint8_t image[CHECK_IMAGE_SIZE];
+    uint32_t order[CHECK_CHUNKS];
+    int failed = 0;
+
+    int fd = mkstemp(flash_path);
+    if (fd < 0)
+    {
+        perror(flash_path);
+        return 1;
+    }
+    close(fd);
+    int ret = emulator_flash_open(flash_path);
+    unlink(flash_path);
+    if (ret != 0)
+    {
+        return 1;
+    }
+
+    /* each context sends straight into the other one */
+    device_ctx = xlink_context_create(&port, &host_ctx);
+    host_ctx = xlink_context_create(&port, &device_ctx);
+    if (device_ctx == NULL || host_ctx == NULL || upgrade_init(device_ctx) != 0 ||
+        xlink_register_msg_handler(host_ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE_RESPONSE, start_response_cb, NULL) == NULL ||
+        xlink_register_msg_handler(host_ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, chunk_response_cb, NULL) == NULL ||
+        xlink_register_msg_handler(host_ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE_RESPONSE, finalize_response_cb, NULL) == NULL)
+    {
+        printf("check init failed\n");
+        return 1;
+    }
+
+    srand(1);
+    for (uint32_t i = 0; i < CHECK_IMAGE_SIZE; i++)
+    {
+        image[i] = (uint8_t)rand();
+    }
+
+    for (uint32_t i = 0; i < CHECK_CHUNKS; i++)
+    {
+        order[i] = i;
+    }
+    failed |= run_session("forward", image, order) != 0;
+
+    for (uint32_t i = 0; i < CHECK_CHUNKS; i++)
+    {
+        order[i] = CHECK_CHUNKS - 1 - i;
+    }
+    failed |= run_session("reverse", image, order) < 0;
+
+    /* even chunks from the top first: every one of them opens both of its edges */
+    for (uint32_t i = 0; i < CHECK_CHUNKS / 2; i++)
+    {
+        order[i] = CHECK_CHUNKS - 2 - 2 * i;
+        order[CHECK_CHUNKS / 2 + i] = CHECK_CHUNKS - 1 - 2 * i;
+    }
+    failed |= run_session("interleaved", image, order) < 0;
+
+    /* with PAGE_ERASE a chunk must not straddle two pages */
+    start_accepted = 1;
+    xlink_upgrade_start_firmware_upgrade_send(host_ctx, CHECK_ADDRESS, CHECK_IMAGE_SIZE, CHECK_CHUNK_SIZE, XLINK_UPGRADE_FLAG_PAGE_ERASE, 0);
+    printf("%-12s %s\n", "page erase", start_accepted ? "FAILED, straddling chunk size accepted" : "ok, straddling chunk size rejected");
+    failed |= start_accepted;
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+/*
+ * Host stand-in for the parts of the FreeRTOS API used by device sources
+ * that are also built for the host tools and the emulator. Tasks are POSIX
+ * threads, the heap is the C library heap and critical sections take one
+ * process wide recursive lock, see freertos_host.c.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define configTICK_RATE_HZ 1000U
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000U))
+
+#define configMINIMAL_STACK_SIZE 128U
+#define configMAX_PRIORITIES 5U
+#define tskIDLE_PRIORITY 0U
+
+static inline void *pvPortMalloc(size_t size)
+{
+    return malloc(size);
+}
+
+static inline void vPortFree(void *ptr)
+{
+    free(ptr);
+}
+
+void host_critical_enter(void);
+void host_critical_exit(void);
+
+#define taskENTER_CRITICAL() host_critical_enter()
+#define taskEXIT_CRITICAL() host_critical_exit()
+#define taskENTER_CRITICAL_FROM_ISR() (host_critical_enter(), (UBaseType_t)0)
+#define taskEXIT_CRITICAL_FROM_ISR(mask) ((void)(mask), host_critical_exit())
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "timers.h"
+
+/*
+ * POSIX implementation of host/FreeRTOS.h. There is no scheduler: tasks run
+ * as real threads, blocking calls wait on condition variables with the
+ * timeout converted from ticks of 1 ms.
+ */
+
+static pthread_mutex_t critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void host_critical_enter(void)
+{
+    pthread_mutex_lock(&critical_lock);
+}
+
+void host_critical_exit(void)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
+
+struct host_task_start
+{
+    TaskFunction_t task;
+    void *parameters;
+};
+
+static void *host_task_entry(void *arg)
+{
+    struct host_task_start start = *(struct host_task_start *)arg;
+    free(arg);
+    start.task(start.parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task,
+                       const char *name,
+                       uint32_t stack_depth,
+                       void *parameters,
+                       UBaseType_t priority,
+                       TaskHandle_t *created_task)
+{
+    pthread_t thread;
+    struct host_task_start *start = malloc(sizeof(*start));
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+
+    if (start == NULL)
+    {
+        return pdFAIL;
+    }
+    start->task = task;
+    start->parameters = parameters;
+    if (pthread_create(&thread, NULL, host_task_entry, start) != 0)
+    {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (created_task)
+    {
+        *created_task = (TaskHandle_t)thread;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    (void)task;
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ),
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+void taskYIELD(void)
+{
+    sched_yield();
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+    return taskSCHEDULER_RUNNING;
+}
+
+struct host_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    pthread_condattr_t attr;
+    QueueHandle_t queue = malloc(sizeof(*queue) + length * item_size);
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->not_empty, &attr);
+    pthread_cond_init(&queue->not_full, &attr);
+    pthread_condattr_destroy(&attr);
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+/* wait on cond until woken or the ticks run out, returns 0 on timeout */
+static int queue_wait(QueueHandle_t queue, pthread_cond_t *cond, TickType_t ticks_to_wait, const struct timespec *deadline)
+{
+    if (ticks_to_wait == 0)
+    {
+        return 0;
+    }
+    if (ticks_to_wait == portMAX_DELAY)
+    {
+        pthread_cond_wait(cond, &queue->lock);
+        return 1;
+    }
+    return pthread_cond_timedwait(cond, &queue->lock, deadline) != ETIMEDOUT;
+}
+
+static void queue_deadline(TickType_t ticks_to_wait, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    if (ticks_to_wait == portMAX_DELAY)
+    {
+        return;
+    }
+    deadline->tv_sec += ticks_to_wait / configTICK_RATE_HZ;
+    deadline->tv_nsec += (long)(ticks_to_wait % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ);
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    queue_deadline(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length)
+    {
+        if (!queue_wait(queue, &queue->not_full, ticks_to_wait, &deadline))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size)
+    {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    queue_deadline(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        if (!queue_wait(queue, &queue->not_empty, ticks_to_wait, &deadline))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size)
+    {
+        memcpy(buffer, queue->items + queue->head * queue->item_size, queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+struct host_timer
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    TickType_t period;
+    UBaseType_t auto_reload;
+    void *timer_id;
+    TimerCallbackFunction_t callback;
+    int active;
+    struct timespec expiry;
+};
+
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void *host_timer_entry(void *arg)
+{
+    TimerHandle_t timer = arg;
+    struct timespec now;
+
+    pthread_mutex_lock(&timer->lock);
+    for (;;)
+    {
+        if (!timer->active)
+        {
+            pthread_cond_wait(&timer->changed, &timer->lock);
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timespec_before(&now, &timer->expiry))
+        {
+            pthread_cond_timedwait(&timer->changed, &timer->lock, &timer->expiry);
+            continue;
+        }
+        if (timer->auto_reload)
+        {
+            queue_deadline(timer->period, &timer->expiry);
+        }
+        else
+        {
+            timer->active = 0;
+        }
+        /* the callback may stop or restart its own timer */
+        pthread_mutex_unlock(&timer->lock);
+        timer->callback(timer);
+        pthread_mutex_lock(&timer->lock);
+    }
+    return NULL;
+}
+
+TimerHandle_t xTimerCreate(const char *name,
+                           TickType_t period,
+                           UBaseType_t auto_reload,
+                           void *timer_id,
+                           TimerCallbackFunction_t callback)
+{
+    pthread_condattr_t attr;
+    pthread_t thread;
+    TimerHandle_t timer = malloc(sizeof(*timer));
+    (void)name;
+
+    if (timer == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&timer->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    timer->timer_id = timer_id;
+    timer->callback = callback;
+    timer->active = 0;
+    if (pthread_create(&thread, NULL, host_timer_entry, timer) != 0)
+    {
+        free(timer);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return timer;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks_to_wait)
+{
+    (void)ticks_to_wait;
+    pthread_mutex_lock(&timer->lock);
+    timer->period = period;
+    timer->active = 1;
+    queue_deadline(period, &timer->expiry);
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    return xTimerChangePeriod(timer, timer->period, ticks_to_wait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    (void)ticks_to_wait;
+    pthread_mutex_lock(&timer->lock);
+    timer->active = 0;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->timer_id;
+}
@@ -0,0 +1,25 @@
+#ifndef HOST_TIMERS_H
+#define HOST_TIMERS_H
+
+#include "FreeRTOS.h"
+
+typedef struct host_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+/* every timer has its own thread, callbacks of different timers may run concurrently */
+TimerHandle_t xTimerCreate(const char *name,
+                           TickType_t period,
+                           UBaseType_t auto_reload,
+                           void *timer_id,
+                           TimerCallbackFunction_t callback);
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait);
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait);
+
+/* also starts a stopped timer, like FreeRTOS */
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks_to_wait);
+
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif // HOST_TIMERS_H
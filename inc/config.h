@@ -1,7 +1,8 @@
 #define BSP_USING_SIMPLE_UART
 #define BSP_USING_UART1
 #define BSP_UART1_BAUDRATE 115200
-#define BSP_UART1_RX_BUFSIZE 270
+#define BSP_UART1_BAUDRATE_MAX 2000000
+#define BSP_UART1_RX_BUFSIZE 1024
 #define BSP_UART1_TX_USING_DMA
 #define SOC_GD32C103CBT6
 #define SOC_SERIES_GD32C10x
\ No newline at end of file
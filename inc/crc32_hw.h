@@ -0,0 +1,62 @@
+#pragma once
+#ifndef _CRC32_HW_H_
+#define _CRC32_HW_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "partition.h"
+#include "gd32c10x.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+     * crc32_calculate() on the GD32C10x CRC unit, selected with
+     * PARTITION_CRC32_HW. The unit shifts MSB first, starts from 0xFFFFFFFF
+     * after a reset and takes one word per write, while crc32tab is the
+     * reflected polynomial. Feeding bit reversed words and reversing the
+     * result gives the reflected CRC; the caller's state is folded into the
+     * first word because CRC(R, W) only depends on R ^ W for a whole word.
+     * Unaligned head and tail bytes go through crc32_update().
+     *
+     * The unit is not locked, callers must not run concurrently.
+     */
+
+    static inline uint32_t crc32_update_hw(const uint8_t *buf, size_t size, uint32_t crc)
+    {
+        size_t head = (4 - ((uintptr_t)buf & 3)) & 3;
+        if (head > size)
+        {
+            head = size;
+        }
+        crc = crc32_update(buf, head, crc);
+        buf += head;
+        size -= head;
+
+        if (size >= 4)
+        {
+            const uint32_t *word = (const uint32_t *)buf;
+            size_t words = size / 4;
+
+            rcu_periph_clock_enable(RCU_CRC);
+            crc_data_register_reset();
+            CRC_DATA = __RBIT(*word++ ^ crc) ^ 0xFFFFFFFF;
+            while (--words > 0)
+            {
+                CRC_DATA = __RBIT(*word++);
+            }
+            crc = __RBIT(CRC_DATA);
+            buf = (const uint8_t *)word;
+            size &= 3;
+        }
+
+        return crc32_update(buf, size, crc);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _CRC32_HW_H_
@@ -17,6 +17,7 @@ extern "C"
         uint8_t *buffer;
         size_t size;
         struct dma_element *next, *prev;
+        volatile uint32_t ready; // frame filled in, may be transmitted
     };
 
     int uart_init(void);
@@ -28,9 +29,20 @@ extern "C"
      */
     void *gd32_uart_get_handle(const char *name);
 
-    struct dma_element * get_rx_block(void *handle);
+    /**
+     * @description: 获取接收环形缓冲区中可读的连续数据，不拷贝
+     * @param {void} *handle，UART 句柄
+     * @param {const uint8_t} **data，返回数据起始地址
+     * @return {size_t} 返回连续可读字节数，0 表示没有数据
+     */
+    size_t gd32_uart_rx_span(void *handle, const uint8_t **data);
 
-    void free_rx_block(void *handle, struct dma_element *element);
+    /**
+     * @description: 释放 gd32_uart_rx_span 返回的数据
+     * @param {void} *handle，UART 句柄
+     * @param {size_t} size，已处理的字节数
+     */
+    void gd32_uart_rx_consume(void *handle, size_t size);
 
     /**
      * @description: 注册接收回调函数
@@ -51,11 +63,37 @@ extern "C"
      */
     int gd32_uart_dma_send(void *handle, const uint8_t *buf, size_t size);
 
+    /**
+     * @description: 在发送环形缓冲区中预留一帧，帧按申请顺序发送
+     * @param {void} *handle，UART 句柄
+     * @param {size_t} size，帧大小
+     * @return {struct dma_element*} 返回帧，缓冲区不足返回 NULL
+     */
     struct dma_element *gd32_uart_alloc_dma_element(void *handle, size_t size);
 
+    /**
+     * @description: 提交已填充的帧，相邻的已提交帧合并为一次 DMA 发送
+     * @param {void} *handle，UART 句柄
+     * @param {struct dma_element} *element，gd32_uart_alloc_dma_element 返回的帧
+     * @return {int} 返回结果，0 成功，其他失败
+     */
     int gd32_uart_append_dma_send_list(void *handle, struct dma_element *element);
 
-    void gd32_uart_set_baudrate(void *handle, uint32_t baudrate);
+    /**
+     * @description: 修改波特率，分频误差超过 2% 时不修改
+     * @param {void} *handle，UART 句柄
+     * @param {uint32_t} baudrate，波特率
+     * @return {int} 返回结果，0 成功，其他失败
+     */
+    int gd32_uart_set_baudrate(void *handle, uint32_t baudrate);
+
+    /**
+     * @description: 等待已提交的帧全部发送完成，包括最后一个字节的停止位
+     * @param {void} *handle，UART 句柄
+     * @param {uint32_t} timeout_ms，超时时间（毫秒）
+     * @return {int} 返回结果，0 成功，超时返回 -1
+     */
+    int gd32_uart_tx_drain(void *handle, uint32_t timeout_ms);
 
 #ifdef __cplusplus
 }
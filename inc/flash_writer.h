@@ -0,0 +1,44 @@
+#ifndef FLASH_WRITER_H
+#define FLASH_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Write-combining layer over onchip_flash_port.
+ *
+ * fmc_program_data only programs whole, word aligned words and a flash word
+ * can be programmed once per erase. The writer accepts any address, length
+ * and source alignment: whole words go straight to flash, the bytes of a
+ * word that is only partly covered wait in a cache until the rest of the
+ * word arrives, which may be a later write at a lower or higher address.
+ * flash_writer_flush programs the remaining partial words padded with 0xFF.
+ *
+ * The cache is provided by the caller. A write that needs a partial word
+ * when every entry is taken fails: programming a word early would make the
+ * bytes still to come impossible to write, so the caller has to bound how
+ * many words it leaves open.
+ */
+
+typedef struct flash_writer_word_def
+{
+    uint32_t address; // word aligned flash address
+    uint8_t data[4];
+    uint8_t valid; // bit n set when data[n] was written, 0 for a free slot
+} flash_writer_word_t;
+
+typedef struct flash_writer_def
+{
+    flash_writer_word_t *partial;
+    uint32_t partial_count;
+} flash_writer_t, *flash_writer_p;
+
+void flash_writer_init(flash_writer_p writer, flash_writer_word_t *partial, uint32_t partial_count);
+
+/* returns 0 on success, -1 if programming failed or the cache is full */
+int flash_writer_write(flash_writer_p writer, uint32_t address, const void *data, uint32_t size);
+
+/* program all partial words, returns 0 on success, -1 if programming failed */
+int flash_writer_flush(flash_writer_p writer);
+
+#endif // !FLASH_WRITER_H
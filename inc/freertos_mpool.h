@@ -6,13 +6,33 @@
 #include <string.h>
 #include <FreeRTOS.h>
 
+/*
+ * Fixed size block pool. Free blocks are chained through their first word,
+ * so alloc and free are O(1) and run in a short critical section that is
+ * safe from both tasks and ISRs. markers tracks which blocks are handed out
+ * and makes a double free harmless.
+ */
+
+/* blocks hold the free-list link while free, so they are at least a pointer wide and aligned */
+#define OS_POOL_ITEM_SIZE(item_sz) \
+    (((item_sz) < sizeof(void *) ? sizeof(void *) : (item_sz) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* static backing for osPoolInitStatic, no heap involved */
+#define OS_POOL_STATIC_DEF(name, count, item_sz)                                \
+    static void *name##_storage[(count) * OS_POOL_ITEM_SIZE(item_sz) / sizeof(void *)]; \
+    static uint8_t name##_markers[(count)];                                     \
+    static os_pool_t name##_control
+
 typedef struct
 {
     void *pool;
     uint8_t *markers;
     uint32_t pool_sz;
     uint32_t item_sz;
-    uint32_t currentIndex;
+    void *free_list;
+    uint32_t used;      // blocks handed out now
+    uint32_t max_used;  // high-water mark of used
+    uint32_t failures;  // allocations that found the pool empty
 } os_pool_t, *os_pool_p;
 
 os_pool_p osPoolInit(void *pool,
@@ -20,6 +40,12 @@ os_pool_p osPoolInit(void *pool,
                      uint32_t pool_sz,
                      uint32_t item_sz);
 
+os_pool_p osPoolInitStatic(os_pool_p pool_id,
+                           void *pool,
+                           uint8_t *markers,
+                           uint32_t pool_sz,
+                           uint32_t item_sz);
+
 void *osPoolAlloc(os_pool_p pool_id);
 
 void osPoolFree(os_pool_p pool_id, void *block);
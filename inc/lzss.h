@@ -0,0 +1,206 @@
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+     * Byte oriented LZSS used for compressed firmware upgrades.
+     *
+     * The stream is a sequence of groups: one flag byte followed by up to 8
+     * items, flag bit n (LSB first) describes item n. A set bit is a literal
+     * byte, a clear bit is a 2 byte match:
+     *
+     * | byte 0          | byte 1                           |
+     * | --------------- | -------------------------------- |
+     * | distance-1 [7:0]| distance-1 [9:8] << 6 | len - 3  |
+     *
+     * The stream has no end marker, the decoder stops when the input runs out.
+     */
+
+#define LZSS_WINDOW_BITS 10
+#define LZSS_WINDOW_SIZE (1U << LZSS_WINDOW_BITS)
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 0x3F)
+
+    enum LzssState
+    {
+        LZSS_STATE_FLAGS = 0,
+        LZSS_STATE_ITEM,
+        LZSS_STATE_MATCH
+    };
+
+    struct lzss_decoder_def
+    {
+        uint8_t window[LZSS_WINDOW_SIZE]; // last decoded bytes, matches copy from here
+        uint16_t window_pos;
+        uint16_t match_distance;
+        uint8_t match_remaining; // bytes of the current match not yet produced
+        uint8_t match_low;       // first match byte when a match is split across inputs
+        uint8_t flags;
+        uint8_t items; // items left in the current group
+        uint8_t state;
+    };
+
+    typedef struct lzss_decoder_def lzss_decoder_t, *lzss_decoder_p;
+
+    static inline void lzss_decoder_init(lzss_decoder_p decoder)
+    {
+        memset(decoder, 0, sizeof(*decoder));
+    }
+
+    static inline void lzss_decoder_put(lzss_decoder_p decoder, uint8_t c)
+    {
+        decoder->window[decoder->window_pos] = c;
+        decoder->window_pos = (decoder->window_pos + 1) & (LZSS_WINDOW_SIZE - 1);
+    }
+
+    static inline void lzss_decoder_next_item(lzss_decoder_p decoder)
+    {
+        decoder->flags >>= 1;
+        decoder->state = --decoder->items == 0 ? LZSS_STATE_FLAGS : LZSS_STATE_ITEM;
+    }
+
+    /*
+     * Decode from *in into out until out is full or the input is used up.
+     * Consumed input is removed from *in and *in_len, the decoder keeps any
+     * partial item so the stream may be split at any byte.
+     * Returns the number of bytes written to out.
+     */
+    static inline size_t lzss_decode(lzss_decoder_p decoder,
+                                     const uint8_t **in,
+                                     size_t *in_len,
+                                     uint8_t *out,
+                                     size_t out_len)
+    {
+        size_t produced = 0;
+        while (produced < out_len)
+        {
+            if (decoder->match_remaining > 0)
+            {
+                uint8_t c = decoder->window[(decoder->window_pos - decoder->match_distance) & (LZSS_WINDOW_SIZE - 1)];
+                lzss_decoder_put(decoder, c);
+                out[produced++] = c;
+                decoder->match_remaining--;
+                continue;
+            }
+            if (*in_len == 0)
+            {
+                break;
+            }
+            uint8_t c = *(*in)++;
+            (*in_len)--;
+            switch (decoder->state)
+            {
+            case LZSS_STATE_FLAGS:
+                decoder->flags = c;
+                decoder->items = 8;
+                decoder->state = LZSS_STATE_ITEM;
+                break;
+            case LZSS_STATE_ITEM:
+                if (decoder->flags & 1)
+                {
+                    lzss_decoder_put(decoder, c);
+                    out[produced++] = c;
+                    lzss_decoder_next_item(decoder);
+                }
+                else
+                {
+                    decoder->match_low = c;
+                    decoder->state = LZSS_STATE_MATCH;
+                }
+                break;
+            case LZSS_STATE_MATCH:
+                decoder->match_distance = (uint16_t)((((c >> 6) << 8) | decoder->match_low) + 1);
+                decoder->match_remaining = (uint8_t)((c & 0x3F) + LZSS_MIN_MATCH);
+                lzss_decoder_next_item(decoder);
+                break;
+            default:
+                return produced;
+            }
+        }
+        return produced;
+    }
+
+    /*
+     * Compress in into out, the worst case output is in_len + in_len / 8 + 1.
+     * Returns the compressed size, or 0 if out_cap is too small.
+     * Meant for the host tools, the search is exhaustive over the window.
+     */
+    static inline size_t lzss_encode(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap)
+    {
+        size_t pos = 0;
+        size_t out_pos = 0;
+        size_t flag_pos = 0;
+        unsigned bit = 8;
+
+        while (pos < in_len)
+        {
+            if (bit == 8)
+            {
+                if (out_pos >= out_cap)
+                {
+                    return 0;
+                }
+                flag_pos = out_pos++;
+                out[flag_pos] = 0;
+                bit = 0;
+            }
+
+            size_t max_len = in_len - pos < LZSS_MAX_MATCH ? in_len - pos : LZSS_MAX_MATCH;
+            size_t window_start = pos > LZSS_WINDOW_SIZE ? pos - LZSS_WINDOW_SIZE : 0;
+            size_t best_len = 0;
+            size_t best_distance = 0;
+            for (size_t candidate = pos; candidate-- > window_start;)
+            {
+                size_t len = 0;
+                while (len < max_len && in[candidate + len] == in[pos + len])
+                {
+                    len++;
+                }
+                if (len > best_len)
+                {
+                    best_len = len;
+                    best_distance = pos - candidate;
+                    if (len == max_len)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if (best_len >= LZSS_MIN_MATCH)
+            {
+                if (out_pos + 2 > out_cap)
+                {
+                    return 0;
+                }
+                out[out_pos++] = (uint8_t)(best_distance - 1);
+                out[out_pos++] = (uint8_t)((((best_distance - 1) >> 8) << 6) | (best_len - LZSS_MIN_MATCH));
+                pos += best_len;
+            }
+            else
+            {
+                if (out_pos >= out_cap)
+                {
+                    return 0;
+                }
+                out[flag_pos] |= (uint8_t)(1U << bit);
+                out[out_pos++] = in[pos++];
+            }
+            bit++;
+        }
+        return out_pos;
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !LZSS_H
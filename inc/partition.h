@@ -81,6 +81,40 @@ extern "C"
 
     typedef struct AppInfo_def AppInfo_t, *AppInfo_p;
 
+    /*
+     * The second page of BOOTFROM is an append-only list of boot validation
+     * tokens, one word each. The bootloader appends the token of an app once
+     * its full CRC check passed, later boots only look the token up. Starting
+     * an upgrade erases the list, so a rewritten slot is verified again.
+     */
+#define PARTITION_ADDRESS_BOOT_RECORDS (PARTITION_ADDRESS_BOOTFROM + PARTITION_SIZE_BOOTFROM / 2)
+#define PARTITION_SIZE_BOOT_RECORDS (PARTITION_SIZE_BOOTFROM / 2)
+
+    /*
+     * The last page of PARAMS is reserved for the journal of the upgrade session
+     * in progress, so a transfer cut off by a link loss or a power failure can
+     * be resumed. User parameters only own the pages below it. The header is
+     * programmed with the magic number last, then the word of each page of the
+     * session is cleared once that page is erased for writing. Starting a new
+     * session or finalizing one successfully erases the page.
+     */
+#define PARTITION_SIZE_UPGRADE_JOURNAL 1024
+#define PARTITION_ADDRESS_UPGRADE_JOURNAL (PARTITION_ADDRESS_PARAMS + PARTITION_SIZE_PARAMS - PARTITION_SIZE_UPGRADE_JOURNAL)
+#define PARTITION_SIZE_USER_PARAMS (PARTITION_SIZE_PARAMS - PARTITION_SIZE_UPGRADE_JOURNAL)
+#define UPGRADE_JOURNAL_MAX_PAGES 128 // every page of the 128KB flash
+
+    struct UpgradeJournal_def
+    {
+        uint32_t magicNumber; // Magic number to validate structure, programmed last
+        uint32_t session_id;  // chosen by the host, identifies the image being written
+        uint32_t start_address;
+        uint32_t size_bytes;
+        uint32_t reserved[4];                      // Reserved for future use
+        uint32_t pages[UPGRADE_JOURNAL_MAX_PAGES]; // 0 once the page was erased for writing
+    } __attribute__((packed));
+
+    typedef struct UpgradeJournal_def UpgradeJournal_t, *UpgradeJournal_p;
+
 #ifndef PARTITION_CRC32
 #define PARTITION_CRC32
     static const uint32_t crc32tab[] = {
@@ -149,13 +183,43 @@ extern "C"
         0xb3667a2eL, 0xc4614ab8L, 0x5d681b02L, 0x2a6f2b94L,
         0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL, 0x2d02ef8dL};
 
-    static inline uint32_t crc32_calculate(const uint8_t *buf, size_t size, uint32_t crc)
+    static inline uint32_t crc32_update(const uint8_t *buf, size_t size, uint32_t crc)
     {
-        uint32_t i;
+        size_t i;
 
         for (i = 0; i < size; i++)
             crc = crc32tab[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
 
+        return crc;
+    }
+
+/*
+ * 1 keeps the 1 KB byte table, 4 and 8 pick the slicing kernels of
+ * crc32_slicing.h at 4 KB and 8 KB of tables. The bootloader stays at 1.
+ * PARTITION_CRC32_HW uses the CRC unit of the MCU instead, host builds
+ * always take the table path.
+ */
+#ifndef PARTITION_CRC32_SLICES
+#define PARTITION_CRC32_SLICES 1
+#endif
+
+#if defined(PARTITION_CRC32_HW) && defined(SOC_GD32C103CBT6) && defined(__arm__)
+#include "crc32_hw.h"
+#elif PARTITION_CRC32_SLICES > 1
+#include "crc32_slicing.h"
+#endif
+
+    static inline uint32_t crc32_calculate(const uint8_t *buf, size_t size, uint32_t crc)
+    {
+#if defined(PARTITION_CRC32_HW) && defined(SOC_GD32C103CBT6) && defined(__arm__)
+        crc = crc32_update_hw(buf, size, crc);
+#elif PARTITION_CRC32_SLICES >= 8
+        crc = crc32_update_slice8(buf, size, crc);
+#elif PARTITION_CRC32_SLICES >= 4
+        crc = crc32_update_slice4(buf, size, crc);
+#else
+        crc = crc32_update(buf, size, crc);
+#endif
         return crc ^ 0xFFFFFFFF;
     }
 #endif // PARTITION_CRC32
@@ -163,10 +227,52 @@ extern "C"
 #if defined(SOC_GD32C103CBT6) && defined(__arm__)
 #include "gd32c10x.h"
 
+    /* identifies an app header in its slot, never the erased word */
+    static inline uint32_t boot_record_token(const AppInfo_t *app_info, uint32_t app_address)
+    {
+        uint32_t token = crc32_calculate((const uint8_t *)app_info, sizeof(AppInfo_t), app_address);
+        return token == 0xFFFFFFFF ? 0 : token;
+    }
+
+    static inline int boot_record_find(uint32_t token)
+    {
+        const uint32_t *record = (const uint32_t *)PARTITION_ADDRESS_BOOT_RECORDS;
+        for (uint32_t i = 0; i < PARTITION_SIZE_BOOT_RECORDS / 4 && record[i] != 0xFFFFFFFF; i++)
+        {
+            if (record[i] == token)
+            {
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    /* a failed append only costs a full check on the next boot */
+    static inline void boot_record_append(uint32_t token)
+    {
+        const uint32_t *record = (const uint32_t *)PARTITION_ADDRESS_BOOT_RECORDS;
+        uint32_t i = 0;
+        while (i < PARTITION_SIZE_BOOT_RECORDS / 4 && record[i] != 0xFFFFFFFF)
+        {
+            i++;
+        }
+        fmc_unlock();
+        fmc_flag_clear(FMC_FLAG_END | FMC_FLAG_WPERR | FMC_FLAG_PGAERR | FMC_FLAG_PGERR);
+        if (i == PARTITION_SIZE_BOOT_RECORDS / 4)
+        {
+            fmc_page_erase(PARTITION_ADDRESS_BOOT_RECORDS);
+            i = 0;
+        }
+        fmc_word_program(PARTITION_ADDRESS_BOOT_RECORDS + i * 4, token);
+        fmc_flag_clear(FMC_FLAG_END | FMC_FLAG_WPERR | FMC_FLAG_PGAERR | FMC_FLAG_PGERR);
+        fmc_lock();
+    }
+
     static inline int check_app_valid(enum ActiveApp app)
     {
         AppInfo_p app_info;
         uint32_t app_address;
+        uint32_t token;
 
         if (app == ACTIVE_APP_A)
         {
@@ -184,12 +290,24 @@ extern "C"
             return -1; // Invalid magic number
         }
 
+        if (app_info->size_bytes > PARTITION_SIZE_APP_A)
+        {
+            return -1; // Image larger than its slot
+        }
+
+        token = boot_record_token(app_info, app_address);
+        if (boot_record_find(token) == 0)
+        {
+            return 0; // Verified on an earlier boot
+        }
+
         if (crc32_calculate((const uint8_t *)app_address, app_info->size_bytes, 0) !=
             app_info->app_checksum)
         {
             return -1; // Checksum mismatch
         }
 
+        boot_record_append(token);
         return 0; // App is valid
     }
 
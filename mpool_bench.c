@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "freertos_mpool.h"
+
+/*
+ * Host benchmark of the osPool block allocator: alloc/free pairs, filling
+ * and draining the whole pool, and a random mix around a live set. Checks
+ * that no block is handed out twice and that the statistics add up.
+ */
+
+#define BENCH_ITEM_SIZE 12 // struct dma_element on the device
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t ops, uint64_t ns, os_pool_p pool)
+{
+    printf("%-12s %10llu ops %8.2f ns/op  used %u max %u failures %u\n",
+           name,
+           (unsigned long long)ops,
+           ops ? (double)ns / (double)ops : 0.0,
+           pool->used,
+           pool->max_used,
+           pool->failures);
+}
+
+static int check_distinct(void **blocks, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        for (uint32_t j = i + 1; j < count; j++)
+        {
+            if (blocks[i] == blocks[j])
+            {
+                printf("block %p handed out twice\n", blocks[i]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = 1000000;
+    uint32_t pool_sz = 16;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:p:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            pool_sz = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printf("Usage: mpool_bench [-n rounds] [-p pool blocks]\n");
+            return -1;
+        }
+    }
+    if (pool_sz == 0)
+    {
+        pool_sz = 1;
+    }
+
+    os_pool_p pool = osPoolInit(NULL, NULL, pool_sz, BENCH_ITEM_SIZE);
+    void **live = calloc(pool_sz, sizeof(void *));
+    if (pool == NULL || live == NULL)
+    {
+        printf("out of memory\n");
+        return -1;
+    }
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        void *block = osPoolAlloc(pool);
+        osPoolFree(pool, block);
+    }
+    report("pair", 2ull * rounds, now_ns() - start, pool);
+
+    uint32_t fills = rounds / pool_sz + 1;
+    start = now_ns();
+    for (uint32_t i = 0; i < fills; i++)
+    {
+        for (uint32_t j = 0; j < pool_sz; j++)
+        {
+            live[j] = osPoolAlloc(pool);
+        }
+        if (osPoolAlloc(pool) != NULL)
+        {
+            printf("allocation from a full pool succeeded\n");
+            return -1;
+        }
+        for (uint32_t j = 0; j < pool_sz; j++)
+        {
+            osPoolFree(pool, live[j]);
+        }
+    }
+    report("fill/drain", (2ull * pool_sz + 1) * fills, now_ns() - start, pool);
+
+    for (uint32_t j = 0; j < pool_sz; j++)
+    {
+        live[j] = osPoolAlloc(pool);
+    }
+    if (check_distinct(live, pool_sz) != 0)
+    {
+        return -1;
+    }
+    for (uint32_t j = 0; j < pool_sz; j++)
+    {
+        osPoolFree(pool, live[j]);
+        osPoolFree(pool, live[j]); // double free is ignored
+        live[j] = NULL;
+    }
+
+    srand(1);
+    start = now_ns();
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        uint32_t slot = (uint32_t)rand() % pool_sz;
+        if (live[slot])
+        {
+            osPoolFree(pool, live[slot]);
+            live[slot] = NULL;
+        }
+        else
+        {
+            live[slot] = osPoolAlloc(pool);
+        }
+    }
+    report("random", rounds, now_ns() - start, pool);
+
+    uint32_t held = 0;
+    for (uint32_t j = 0; j < pool_sz; j++)
+    {
+        held += live[j] != NULL;
+    }
+    if (held != pool->used || pool->failures != fills)
+    {
+        printf("statistics mismatch: held %u used %u failures %u\n", held, pool->used, pool->failures);
+        return -1;
+    }
+
+    free(live);
+    vPortFree(pool->markers);
+    vPortFree(pool->pool);
+    vPortFree(pool);
+    return 0;
+}
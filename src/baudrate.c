@@ -0,0 +1,163 @@
+#include <FreeRTOS.h>
+#include <task.h>
+#include <timers.h>
+#include "config.h"
+#include "drv_simple_uart.h"
+#include "xlink_upgrade.h"
+
+/*
+ * Runtime baudrate switch of the xlink UART. The host proposes a rate with
+ * SetBaudrate, the response still goes out at the old rate and the device
+ * switches once it has left the line. The host then sends ConfirmBaudrate at
+ * the new rate; if it does not arrive within confirm_timeout_ms the device
+ * goes back to BSP_UART1_BAUDRATE, which is also where the host retries.
+ *
+ * A negotiated rate is dropped again after BAUDRATE_IDLE_MS without any
+ * message, so a host that went away finds the device at the default rate.
+ */
+#define BAUDRATE_DEFAULT BSP_UART1_BAUDRATE
+#define BAUDRATE_IDLE_MS 10000 // longer than the slowest handler, e.g. a full finalize
+#define BAUDRATE_CONFIRM_MIN_MS 50
+#define BAUDRATE_CONFIRM_MAX_MS 5000
+#define BAUDRATE_DRAIN_MS 100
+
+static void *uart;
+static TimerHandle_t fallback_timer;
+static uint32_t current_baudrate = BAUDRATE_DEFAULT;
+static volatile bool confirming; // switched, ConfirmBaudrate not seen yet
+static volatile bool rx_activity;
+
+/* runs on the timer task, the xlink task only checks the state inside a critical section */
+static void fallback_timer_cb(TimerHandle_t timer)
+{
+    taskENTER_CRITICAL();
+    if (!confirming && rx_activity)
+    {
+        rx_activity = false;
+        taskEXIT_CRITICAL();
+        return;
+    }
+    confirming = false;
+    current_baudrate = BAUDRATE_DEFAULT;
+    taskEXIT_CRITICAL();
+    gd32_uart_set_baudrate(uart, BAUDRATE_DEFAULT);
+    xTimerStop(timer, 0);
+}
+
+void baudrate_rx_activity(void)
+{
+    rx_activity = true;
+}
+
+static int SetBaudrate_cb(uint8_t comp_id,
+                          uint8_t msg_id,
+                          const uint8_t *payload,
+                          uint8_t payload_len,
+                          void *user_data)
+{
+    xlink_upgrade_set_baudrate_t *msg = (xlink_upgrade_set_baudrate_t *)payload;
+    uint16_t timeout_ms;
+    if (payload_len < sizeof(*msg) ||
+        msg->baudrate < BAUDRATE_DEFAULT ||
+        msg->baudrate > BSP_UART1_BAUDRATE_MAX)
+    {
+        xlink_upgrade_set_baudrate_response_send((xlink_context_p)user_data,
+                                                 payload_len < sizeof(*msg) ? 0 : msg->baudrate,
+                                                 false);
+        return -1;
+    }
+    timeout_ms = msg->confirm_timeout_ms;
+    if (timeout_ms < BAUDRATE_CONFIRM_MIN_MS)
+    {
+        timeout_ms = BAUDRATE_CONFIRM_MIN_MS;
+    }
+    else if (timeout_ms > BAUDRATE_CONFIRM_MAX_MS)
+    {
+        timeout_ms = BAUDRATE_CONFIRM_MAX_MS;
+    }
+
+    /* hold the fallback off while switching, it may be counting down an earlier rate */
+    xTimerStop(fallback_timer, portMAX_DELAY);
+    xlink_upgrade_set_baudrate_response_send((xlink_context_p)user_data,
+                                             msg->baudrate,
+                                             true);
+    if (gd32_uart_tx_drain(uart, BAUDRATE_DRAIN_MS) != 0 ||
+        gd32_uart_set_baudrate(uart, msg->baudrate) != 0)
+    {
+        /* the host sees no confirmation and goes back to the default rate */
+        gd32_uart_set_baudrate(uart, BAUDRATE_DEFAULT);
+        current_baudrate = BAUDRATE_DEFAULT;
+        return -1;
+    }
+    taskENTER_CRITICAL();
+    current_baudrate = msg->baudrate;
+    confirming = true;
+    taskEXIT_CRITICAL();
+    xTimerChangePeriod(fallback_timer, pdMS_TO_TICKS(timeout_ms), portMAX_DELAY);
+    return 0;
+}
+
+static int ConfirmBaudrate_cb(uint8_t comp_id,
+                              uint8_t msg_id,
+                              const uint8_t *payload,
+                              uint8_t payload_len,
+                              void *user_data)
+{
+    xlink_upgrade_confirm_baudrate_t *msg = (xlink_upgrade_confirm_baudrate_t *)payload;
+    bool confirmed;
+    if (payload_len < sizeof(*msg))
+    {
+        return -1;
+    }
+    taskENTER_CRITICAL();
+    /* a repeated confirmation of the rate in use is answered again */
+    confirmed = msg->baudrate == current_baudrate;
+    if (confirmed)
+    {
+        confirming = false;
+        rx_activity = true;
+    }
+    taskEXIT_CRITICAL();
+    if (!confirmed)
+    {
+        return -1;
+    }
+    if (current_baudrate == BAUDRATE_DEFAULT)
+    {
+        xTimerStop(fallback_timer, portMAX_DELAY);
+    }
+    else
+    {
+        xTimerChangePeriod(fallback_timer, pdMS_TO_TICKS(BAUDRATE_IDLE_MS), portMAX_DELAY);
+    }
+    xlink_upgrade_baudrate_confirmed_send((xlink_context_p)user_data,
+                                          current_baudrate);
+    return 0;
+}
+
+int baudrate_init(xlink_context_p context, void *uart_handle)
+{
+    uart = uart_handle;
+    fallback_timer = xTimerCreate("baudrate",
+                                  pdMS_TO_TICKS(BAUDRATE_IDLE_MS),
+                                  pdTRUE,
+                                  NULL,
+                                  fallback_timer_cb);
+    if (fallback_timer == NULL)
+    {
+        return -1;
+    }
+
+    xlink_register_msg_handler(context,
+                               XLINK_COMP_ID_UPGRADE,
+                               XLINK_UPGRADE_MSG_ID_SET_BAUDRATE,
+                               SetBaudrate_cb,
+                               context);
+    xlink_register_msg_handler(context,
+                               XLINK_COMP_ID_UPGRADE,
+                               XLINK_UPGRADE_MSG_ID_CONFIRM_BAUDRATE,
+                               ConfirmBaudrate_cb,
+                               context);
+
+    return 0;
+}
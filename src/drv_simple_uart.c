@@ -1,6 +1,7 @@
 #include "drv_simple_uart.h"
 #include <utlist.h>
 #include <FreeRTOS.h>
+#include <task.h>
 #include "freertos_mpool.h"
 #include <semphr.h>
 #include <string.h>
@@ -8,7 +9,8 @@
 #ifdef BSP_USING_SIMPLE_UART
 
 #define TX_DMA_DATA_MAX_SIZE (270)
-#define TX_DMA_DATA_MAX_CNT (10)
+#define TX_DMA_DATA_MAX_CNT (16)
+#define TX_RING_SIZE (1024)
 
 struct gd32_uart
 {
@@ -23,24 +25,24 @@ struct gd32_uart
     uint32_t rx_port;
     uint16_t rx_pin;
     uint32_t baudrate;
-    struct dma_element *tx_dma_list;
-    struct dma_element *rx_block_list;
-    struct dma_element *current_rx_block;
+    struct dma_element *tx_dma_list; // frames in ring order, sent ones are ready
+    uint8_t *tx_ring;                // frames are built in place back to back
+    uint32_t tx_dma_count;           // frames covered by the running transfer
+    uint8_t *rx_ring;               // circular DMA receive buffer
+    size_t rx_tail;                 // next byte handed to the consumer, task only
+    size_t rx_consumed;             // bytes handed back by the consumer, task only
+    volatile size_t rx_received;    // bytes written by the DMA, interrupt only
     volatile uint32_t tx_dma_state; // 0:stop 1:running
     int (*rx_indicate)(size_t size, void *userdata);
     void *userdata;
 
     os_pool_p tx_dma_element_pool;
-    os_pool_p tx_dma_data_pool;
-
-    os_pool_p rx_block_pool;
-    os_pool_p rx_data_pool;
 
     struct
     {
         struct dma_config rx;
         struct dma_config tx;
-        size_t last_index;
+        size_t last_index; // rx ring write index seen by the last interrupt
         SemaphoreHandle_t sem_ftf;
     } dma;
 };
@@ -76,8 +78,12 @@ static struct gd32_uart uart_obj[] = {
         GPIO_PIN_10,        // rx port, rx pin
         BSP_UART0_BAUDRATE, // default baudrate
         NULL,               // tx_dma_list
-        NULL,               // rx_block_list
-        NULL,               // current_rx_block
+        NULL,               // tx_ring
+        0,                  // tx_dma_count
+        NULL,               // rx_ring
+        0,                  // rx_tail
+        0,                  // rx_consumed
+        0,                  // rx_received
         0,                  // tx_dma_state
         NULL,               // rx_indicate
         NULL,               // userdata
@@ -99,8 +105,12 @@ static struct gd32_uart uart_obj[] = {
         GPIO_PIN_3,         // rx port, rx pin
         BSP_UART1_BAUDRATE, // default baudrate
         NULL,               // tx_dma_list
-        NULL,               // rx_block_list
-        NULL,               // current_rx_block
+        NULL,               // tx_ring
+        0,                  // tx_dma_count
+        NULL,               // rx_ring
+        0,                  // rx_tail
+        0,                  // rx_consumed
+        0,                  // rx_received
         0,                  // tx_dma_state
         NULL,               // rx_indicate
         NULL,               // userdata
@@ -131,8 +141,12 @@ static struct gd32_uart uart_obj[] = {
 #endif
         BSP_UART2_BAUDRATE, // default baudrate
         NULL,               // tx_dma_list
-        NULL,               // rx_block_list
-        NULL,               // current_rx_block
+        NULL,               // tx_ring
+        0,                  // tx_dma_count
+        NULL,               // rx_ring
+        0,                  // rx_tail
+        0,                  // rx_consumed
+        0,                  // rx_received
         0,                  // tx_dma_state
         NULL,               // rx_indicate
         NULL,               // userdata
@@ -154,8 +168,12 @@ static struct gd32_uart uart_obj[] = {
         GPIO_PIN_11,        // rx port, rx pin
         BSP_UART3_BAUDRATE, // default baudrate
         NULL,               // tx_dma_list
-        NULL,               // rx_block_list
-        NULL,               // current_rx_block
+        NULL,               // tx_ring
+        0,                  // tx_dma_count
+        NULL,               // rx_ring
+        0,                  // rx_tail
+        0,                  // rx_consumed
+        0,                  // rx_received
         0,                  // tx_dma_state
         NULL,               // rx_indicate
         NULL,               // userdata
@@ -205,72 +223,142 @@ static inline void _uart_dma_transmit(struct gd32_uart *uart, const uint8_t *buf
     dma_channel_enable(uart->dma.tx.periph, uart->dma.tx.channel);
 }
 
-static void dma_recv_isr(struct gd32_uart *uart)
+/*
+ * Start one transfer over the longest run of ready frames at the head of
+ * tx_dma_list that are contiguous in tx_ring, so queued small frames go out
+ * with a single DMA setup and a single interrupt. Called with the list locked.
+ */
+static void uart_tx_start(struct gd32_uart *uart)
 {
-    size_t counter;
-    counter = dma_transfer_number_get(uart->dma.rx.periph, uart->dma.rx.channel);
-    uart->current_rx_block->size = gd32_uart_buf_size(uart) - counter;
-    DL_APPEND(uart->rx_block_list, uart->current_rx_block);
-    if (uart->rx_indicate)
+    struct dma_element *first = uart->tx_dma_list;
+    struct dma_element *node = first;
+    size_t len = 0;
+
+    uart->tx_dma_count = 0;
+    while (node && node->ready && node->buffer == first->buffer + len)
     {
-        uart->rx_indicate(uart->rx_block_list->size, uart->userdata);
+        len += node->size;
+        uart->tx_dma_count++;
+        node = node->next;
     }
-_back:
-    uart->current_rx_block = osPoolAlloc(uart->rx_block_pool);
-    if (uart->current_rx_block)
+
+    if (len == 0)
     {
-        uart->current_rx_block->prev = uart->current_rx_block->next = NULL;
-        uart->current_rx_block->buffer = osPoolAlloc(uart->rx_data_pool);
-        if (!uart->current_rx_block->buffer)
+        uart->tx_dma_state = 0; // stop
+        return;
+    }
+    uart->tx_dma_state = 1; // running
+    _uart_dma_transmit(uart, first->buffer, len);
+}
+
+/*
+ * Reserve size contiguous bytes in tx_ring behind the newest frame, wrapping
+ * to the start when the end is too short. The oldest frame still queued
+ * bounds the free space. Called with the list locked.
+ */
+static uint8_t *uart_tx_reserve(struct gd32_uart *uart, size_t size)
+{
+    if (uart->tx_dma_list == NULL)
+    {
+        return uart->tx_ring;
+    }
+
+    size_t tail = uart->tx_dma_list->buffer - uart->tx_ring;
+    size_t head = uart->tx_dma_list->prev->buffer + uart->tx_dma_list->prev->size - uart->tx_ring;
+
+    if (head >= tail)
+    {
+        if (TX_RING_SIZE - head >= size)
         {
-            osPoolFree(uart->rx_block_pool, uart->current_rx_block);
-            uart->current_rx_block = NULL;
-            return;
+            return uart->tx_ring + head;
         }
-        else
+        if (size < tail)
         {
-            _gd32_dma_receive(uart,
-                              uart->current_rx_block->buffer,
-                              gd32_uart_buf_size(uart));
+            return uart->tx_ring;
         }
     }
-    else
+    else if (head + size < tail)
     {
-        /* no memory */
-        /* free list head */
-        struct dma_element *node = uart->rx_block_list;
-        if (node)
-        {
-            DL_DELETE(uart->rx_block_list, node);
-            osPoolFree(uart->rx_data_pool, node->buffer);
-            osPoolFree(uart->rx_block_pool, node);
-        }
-        goto _back;
+        return uart->tx_ring + head;
     }
+    return NULL;
 }
 
-struct dma_element *get_rx_block(void *handle)
+/*
+ * The receive DMA runs in circular mode over rx_ring and is never stopped.
+ * IDLE, HTF and FTF interrupts only move the write index forward, so no
+ * byte is lost to re-arming the channel.
+ *
+ * The ring is a single producer, single consumer queue without locks: the
+ * interrupts only write rx_received and the consumer only writes rx_tail and
+ * rx_consumed. Both counters run freely, their difference is the number of
+ * unread bytes even across wrap around. All UART and DMA interrupts share
+ * one priority, so they never preempt each other inside dma_recv_isr. If the
+ * consumer falls a whole ring behind, it drops the unread bytes and the
+ * protocol resyncs.
+ */
+static void dma_recv_isr(struct gd32_uart *uart)
+{
+    size_t size = gd32_uart_buf_size(uart);
+    size_t head = size - dma_transfer_number_get(uart->dma.rx.periph, uart->dma.rx.channel);
+    size_t received;
+
+    if (head == size)
+    {
+        head = 0;
+    }
+    received = (head + size - uart->dma.last_index) % size;
+    if (received == 0)
+    {
+        return;
+    }
+    uart->dma.last_index = head;
+    uart->rx_received += received;
+
+    if (uart->rx_indicate)
+    {
+        uart->rx_indicate(received, uart->userdata);
+    }
+}
+
+size_t gd32_uart_rx_span(void *handle, const uint8_t **data)
 {
     struct gd32_uart *uart = (struct gd32_uart *)handle;
-    taskENTER_CRITICAL();
-    struct dma_element *node = uart->rx_block_list;
-    if (node)
+    size_t size = gd32_uart_buf_size(uart);
+    size_t len = uart->rx_received - uart->rx_consumed;
+
+    /*
+     * A full ring already counts as an overrun: with len == size the write
+     * index sits on rx_tail and the DMA may have overwritten the oldest byte
+     * before the interrupt counted it. rx_received also lags the DMA by up to
+     * half a ring between HTF/FTF/IDLE interrupts, so the consumer must stay
+     * within half of BSP_UARTx_RX_BUFSIZE to never lose a byte.
+     */
+    if (len >= size)
     {
-        DL_DELETE(uart->rx_block_list, node);
-        taskEXIT_CRITICAL();
-        return node;
+        /* the DMA lapped the consumer, skip to the current write index */
+        uart->rx_tail = (uart->rx_tail + len) % size;
+        uart->rx_consumed += len;
+        len = 0;
     }
-    taskEXIT_CRITICAL();
-    return NULL;
+    if (len > size - uart->rx_tail)
+    {
+        len = size - uart->rx_tail; // up to the end of the ring, the rest is the next span
+    }
+    *data = uart->rx_ring + uart->rx_tail;
+    return len;
 }
 
-void free_rx_block(void *handle, struct dma_element *element)
+void gd32_uart_rx_consume(void *handle, size_t size)
 {
     struct gd32_uart *uart = (struct gd32_uart *)handle;
-    taskENTER_CRITICAL();
-    osPoolFree(uart->rx_data_pool, element->buffer);
-    osPoolFree(uart->rx_block_pool, element);
-    taskEXIT_CRITICAL();
+
+    /* an overrun while the span was parsed is dropped by the next rx_span */
+    if (size <= uart->rx_received - uart->rx_consumed)
+    {
+        uart->rx_tail = (uart->rx_tail + size) % gd32_uart_buf_size(uart);
+        uart->rx_consumed += size;
+    }
 }
 
 static void gd32_uart_isr(struct gd32_uart *uart)
@@ -279,13 +367,7 @@ static void gd32_uart_isr(struct gd32_uart *uart)
     if (usart_interrupt_flag_get(uart->periph, USART_INT_FLAG_IDLE) != RESET)
     {
         volatile uint8_t data = (uint8_t)usart_data_receive(uart->periph);
-        /* clear all the interrupt flags */
-        dma_flag_clear(uart->dma.rx.periph, uart->dma.rx.channel, DMA_FLAG_G);
-        dma_flag_clear(uart->dma.rx.periph, uart->dma.rx.channel, DMA_FLAG_ERR);
-        dma_flag_clear(uart->dma.rx.periph, uart->dma.rx.channel, DMA_FLAG_HTF);
-        dma_flag_clear(uart->dma.rx.periph, uart->dma.rx.channel, DMA_FLAG_FTF);
-        dma_channel_disable(uart->dma.rx.periph, uart->dma.rx.channel);
-        dma_deinit(uart->dma.rx.periph, uart->dma.rx.channel);
+        (void)data;
         dma_recv_isr(uart);
 
         usart_interrupt_flag_clear(uart->periph, USART_INT_FLAG_IDLE);
@@ -339,6 +421,19 @@ static void gd32_uart_isr(struct gd32_uart *uart)
     }
 }
 
+static void dma_rx_isr(struct gd32_uart *uart)
+{
+    if (dma_interrupt_flag_get(uart->dma.rx.periph, uart->dma.rx.channel, DMA_INT_FLAG_HTF) != RESET)
+    {
+        dma_interrupt_flag_clear(uart->dma.rx.periph, uart->dma.rx.channel, DMA_INT_FLAG_HTF);
+    }
+    if (dma_interrupt_flag_get(uart->dma.rx.periph, uart->dma.rx.channel, DMA_INT_FLAG_FTF) != RESET)
+    {
+        dma_interrupt_flag_clear(uart->dma.rx.periph, uart->dma.rx.channel, DMA_INT_FLAG_FTF);
+    }
+    dma_recv_isr(uart);
+}
+
 static void dma_tx_isr(struct gd32_uart *uart)
 {
     if (dma_interrupt_flag_get(uart->dma.tx.periph, uart->dma.tx.channel, DMA_INT_FLAG_FTF) != RESET)
@@ -348,62 +443,79 @@ static void dma_tx_isr(struct gd32_uart *uart)
         /* disable dma tx channel */
         dma_channel_disable(uart->dma.tx.periph, uart->dma.tx.channel);
 
-        taskENTER_CRITICAL();
-        struct dma_element *node = uart->tx_dma_list;
-        if (node)
+        /* the list, tx_ring space and tx_dma_state are shared with
+         * gd32_uart_alloc_dma_element and gd32_uart_append_dma_send_list, which
+         * lock them with taskENTER_CRITICAL; that masks this interrupt because
+         * it runs below the syscall ceiling */
+        UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+        while (uart->tx_dma_count > 0 && uart->tx_dma_list)
         {
+            struct dma_element *node = uart->tx_dma_list;
             DL_DELETE(uart->tx_dma_list, node);
-            osPoolFree(uart->tx_dma_data_pool, node->buffer);
             osPoolFree(uart->tx_dma_element_pool, node);
+            uart->tx_dma_count--;
         }
-        if (uart->tx_dma_list)
-        {
-            _uart_dma_transmit(uart, uart->tx_dma_list->buffer, uart->tx_dma_list->size);
-        }
-        else
-        {
-            uart->tx_dma_state = 0; // stop
-        }
-        taskEXIT_CRITICAL();
+        uart_tx_start(uart);
+        taskEXIT_CRITICAL_FROM_ISR(mask);
     }
 }
 
 #if defined(BSP_USING_UART0)
 void USART0_IRQHandler(void)
 {
-    taskENTER_CRITICAL();
     gd32_uart_isr(&uart_obj[UART0_INDEX]);
-    taskEXIT_CRITICAL();
 }
 #endif /* BSP_USING_UART0 */
 
 #if defined(BSP_USING_UART1)
 void USART1_IRQHandler(void)
 {
-    taskENTER_CRITICAL();
     gd32_uart_isr(&uart_obj[UART1_INDEX]);
-    taskEXIT_CRITICAL();
 }
 #endif /* BSP_USING_UART1 */
 
 #if defined(BSP_USING_UART2)
 void USART2_IRQHandler(void)
 {
-    taskENTER_CRITICAL();
     gd32_uart_isr(&uart_obj[UART2_INDEX]);
-    taskEXIT_CRITICAL();
 }
 #endif /* BSP_USING_UART2 */
 
 #if defined(BSP_USING_UART3)
 void UART3_IRQHandler(void)
 {
-    taskENTER_CRITICAL();
     gd32_uart_isr(&uart_obj[UART3_INDEX]);
-    taskEXIT_CRITICAL();
 }
 #endif /* BSP_USING_UART3 */
 
+#if defined(BSP_USING_UART0)
+void DMA0_Channel4_IRQHandler(void)
+{
+    dma_rx_isr(&uart_obj[UART0_INDEX]);
+}
+#endif
+
+#if defined(BSP_USING_UART1)
+void DMA0_Channel5_IRQHandler(void)
+{
+    dma_rx_isr(&uart_obj[UART1_INDEX]);
+}
+#endif
+
+#if defined(BSP_USING_UART2)
+void DMA0_Channel2_IRQHandler(void)
+{
+    dma_rx_isr(&uart_obj[UART2_INDEX]);
+}
+#endif
+
+#if defined(BSP_USING_UART3)
+void DMA1_Channel2_IRQHandler(void)
+{
+    dma_rx_isr(&uart_obj[UART3_INDEX]);
+}
+#endif
+
 #ifdef BSP_UART0_TX_USING_DMA
 void DMA0_Channel3_IRQHandler(void)
 {
@@ -457,6 +569,13 @@ static void _gd32_dma_receive(struct gd32_uart *uart, uint8_t *buffer, uint32_t
     dma_init(uart->dma.rx.periph, uart->dma.rx.channel, &dma_init_struct);
     dma_circulation_enable(uart->dma.rx.periph, uart->dma.rx.channel);
 
+    /* half and full transfer interrupts keep the write index moving during long bursts,
+     * NVIC_SetPriority shifts the level itself so the unshifted syscall ceiling is used */
+    NVIC_SetPriority(uart->dma.rx.irq, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+    NVIC_EnableIRQ(uart->dma.rx.irq);
+    dma_interrupt_enable(uart->dma.rx.periph, uart->dma.rx.channel, DMA_CHXCTL_HTFIE);
+    dma_interrupt_enable(uart->dma.rx.periph, uart->dma.rx.channel, DMA_CHXCTL_FTFIE);
+
     /* enable dma channel */
     dma_channel_enable(uart->dma.rx.periph, uart->dma.rx.channel);
 
@@ -492,7 +611,7 @@ static void gd32_dma_config(struct gd32_uart *uart)
     dma_circulation_disable(uart->dma.tx.periph, uart->dma.tx.channel);
 
     /* enable tx dma interrupt */
-    NVIC_SetPriority(uart->dma.tx.irq, configMAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+    NVIC_SetPriority(uart->dma.tx.irq, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
     NVIC_EnableIRQ(uart->dma.tx.irq);
 
     /* enable transmit complete interrupt */
@@ -506,23 +625,13 @@ static void gd32_dma_config(struct gd32_uart *uart)
     dma_channel_disable(uart->dma.rx.periph, uart->dma.rx.channel);
     dma_deinit(uart->dma.rx.periph, uart->dma.rx.channel);
 
-    uart->current_rx_block = osPoolAlloc(uart->rx_block_pool);
-    if (uart->current_rx_block)
+    if (uart->rx_ring)
     {
-        uart->current_rx_block->prev = uart->current_rx_block->next = NULL;
-        uart->current_rx_block->buffer = osPoolAlloc(uart->rx_data_pool);
-        if (!uart->current_rx_block->buffer)
-        {
-            osPoolFree(uart->rx_block_pool, uart->current_rx_block);
-            uart->current_rx_block = NULL;
-            return;
-        }
-        else
-        {
-            _gd32_dma_receive(uart,
-                              uart->current_rx_block->buffer,
-                              gd32_uart_buf_size(uart));
-        }
+        uart->rx_tail = 0;
+        uart->rx_consumed = 0;
+        uart->rx_received = 0;
+        uart->dma.last_index = 0;
+        _gd32_dma_receive(uart, uart->rx_ring, gd32_uart_buf_size(uart));
     }
 }
 
@@ -538,7 +647,7 @@ static void inline gd32_uart_init(struct gd32_uart *uart)
     /* connect port to USARTx_Rx */
     gpio_init(uart->rx_port, GPIO_MODE_IN_FLOATING, GPIO_OSPEED_50MHZ, uart->rx_pin);
 
-    NVIC_SetPriority(uart->irqn, configMAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+    NVIC_SetPriority(uart->irqn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
     NVIC_EnableIRQ(uart->irqn);
 
     usart_baudrate_set(uart->periph, uart->baudrate);
@@ -552,15 +661,49 @@ static void inline gd32_uart_init(struct gd32_uart *uart)
     gd32_dma_config(uart);
 }
 
-void gd32_uart_set_baudrate(void *handle, uint32_t baudrate)
+int gd32_uart_set_baudrate(void *handle, uint32_t baudrate)
 {
     struct gd32_uart *uart = (struct gd32_uart *)handle;
+    uint32_t uclk;
+    uint32_t udiv;
+    uint32_t actual;
 
-    if (uart == NULL)
-        return;
+    if (uart == NULL || baudrate == 0)
+        return -1;
+
+    /* the same divider usart_baudrate_set() programs, 16x oversampling */
+    uclk = uart->periph == USART0 ? rcu_clock_freq_get(CK_APB2) : rcu_clock_freq_get(CK_APB1);
+    udiv = (uclk + baudrate / 2U) / baudrate;
+    if (udiv < 16U || udiv > 0xFFFFU)
+        return -1;
+    /* both ends sample mid bit, more than 2% off loses the stop bit of a long frame */
+    actual = uclk / udiv;
+    if ((actual > baudrate ? actual - baudrate : baudrate - actual) > baudrate / 50U)
+        return -1;
 
     uart->baudrate = baudrate;
+    usart_disable(uart->periph);
     usart_baudrate_set(uart->periph, uart->baudrate);
+    usart_enable(uart->periph);
+    return 0;
+}
+
+int gd32_uart_tx_drain(void *handle, uint32_t timeout_ms)
+{
+    struct gd32_uart *uart = (struct gd32_uart *)handle;
+    TickType_t start = xTaskGetTickCount();
+
+    if (uart == NULL)
+        return -1;
+
+    /* frames leave the list once their DMA transfer is done, TC once the last stop bit is out */
+    while (uart->tx_dma_list != NULL || usart_flag_get(uart->periph, USART_FLAG_TC) == RESET)
+    {
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(timeout_ms))
+            return -1;
+        vTaskDelay(1);
+    }
+    return 0;
 }
 
 int uart_init(void)
@@ -572,19 +715,8 @@ int uart_init(void)
                                                      NULL,
                                                      TX_DMA_DATA_MAX_CNT,
                                                      sizeof(struct dma_element));
-        uart_obj[i].tx_dma_data_pool = osPoolInit(NULL,
-                                                  NULL,
-                                                  TX_DMA_DATA_MAX_CNT,
-                                                  TX_DMA_DATA_MAX_SIZE);
-
-        uart_obj[i].rx_block_pool = osPoolInit(NULL,
-                                               NULL,
-                                               TX_DMA_DATA_MAX_CNT,
-                                               sizeof(struct dma_element));
-        uart_obj[i].rx_data_pool = osPoolInit(NULL,
-                                              NULL,
-                                              TX_DMA_DATA_MAX_CNT,
-                                              gd32_uart_buf_size(&uart_obj[i]));
+        uart_obj[i].tx_ring = pvPortMalloc(TX_RING_SIZE);
+        uart_obj[i].rx_ring = pvPortMalloc(gd32_uart_buf_size(&uart_obj[i]));
         gd32_uart_init(&uart_obj[i]);
     }
 
@@ -631,39 +763,19 @@ int gd32_uart_set_rx_indicate(void *handle, int (*rx_ind)(size_t size, void *use
 
 int gd32_uart_dma_send(void *handle, const uint8_t *buf, size_t size)
 {
-    struct gd32_uart *uart = (struct gd32_uart *)handle;
     struct dma_element *node;
 
-    if ((uart == NULL) || (buf == NULL) || (size == 0))
+    if ((handle == NULL) || (buf == NULL) || (size == 0))
         return -1;
 
-    node = osPoolAlloc(uart->tx_dma_element_pool);
+    node = gd32_uart_alloc_dma_element(handle, size);
     if (node == NULL)
     {
         return -1;
     }
 
-    node->buffer = osPoolAlloc(uart->tx_dma_data_pool);
-    if (node->buffer == NULL)
-    {
-        osPoolFree(uart->tx_dma_element_pool, node);
-        return -1;
-    }
-
     memcpy(node->buffer, buf, size);
-    node->size = size;
-    node->next = NULL;
-    node->prev = NULL;
-    taskENTER_CRITICAL();
-    DL_APPEND(uart->tx_dma_list, node);
-
-    if (uart->tx_dma_state == 0) // stop
-    {
-        uart->tx_dma_state = 1; // running
-        _uart_dma_transmit(uart, uart->tx_dma_list->buffer, uart->tx_dma_list->size);
-    }
-    taskEXIT_CRITICAL();
-    return 0;
+    return gd32_uart_append_dma_send_list(handle, node);
 }
 
 int gd32_uart_append_dma_send_list(void *handle, struct dma_element *element)
@@ -674,12 +786,11 @@ int gd32_uart_append_dma_send_list(void *handle, struct dma_element *element)
         return -1;
 
     taskENTER_CRITICAL();
-    DL_APPEND(uart->tx_dma_list, element);
+    element->ready = 1;
 
     if (uart->tx_dma_state == 0) // stop
     {
-        uart->tx_dma_state = 1; // running
-        _uart_dma_transmit(uart, uart->tx_dma_list->buffer, uart->tx_dma_list->size);
+        uart_tx_start(uart);
     }
     taskEXIT_CRITICAL();
     return 0;
@@ -690,26 +801,31 @@ struct dma_element *gd32_uart_alloc_dma_element(void *handle, size_t size)
     struct dma_element *element;
     struct gd32_uart *uart = (struct gd32_uart *)handle;
 
-    if (size == 0 || size > TX_DMA_DATA_MAX_SIZE)
+    if (size == 0 || size > TX_DMA_DATA_MAX_SIZE || uart->tx_ring == NULL)
         return NULL;
 
     element = osPoolAlloc(uart->tx_dma_element_pool);
-    if (element)
+    if (element == NULL)
     {
-        element->buffer = osPoolAlloc(uart->tx_dma_data_pool);
-        if (element->buffer == NULL)
-        {
-            osPoolFree(uart->tx_dma_element_pool, element);
-            element = NULL;
-        }
-        else
-        {
-            element->size = size;
-            element->next = NULL;
-            element->prev = NULL;
-        }
+        return NULL;
     }
 
+    taskENTER_CRITICAL();
+    element->buffer = uart_tx_reserve(uart, size);
+    if (element->buffer == NULL)
+    {
+        taskEXIT_CRITICAL();
+        osPoolFree(uart->tx_dma_element_pool, element);
+        return NULL;
+    }
+    element->size = size;
+    element->ready = 0;
+    element->next = NULL;
+    element->prev = NULL;
+    /* queued in ring order now, sent once the caller appends it */
+    DL_APPEND(uart->tx_dma_list, element);
+    taskEXIT_CRITICAL();
+
     return element;
 }
 
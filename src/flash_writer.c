@@ -0,0 +1,107 @@
+#include <string.h>
+#include "flash_writer.h"
+#include "onchip_flash_port.h"
+
+#define FLASH_WRITER_BLOCK 64 // whole words copied to an aligned buffer per fmc_program_data call
+
+static int program_partial(flash_writer_word_t *word)
+{
+    uint32_t value;
+    memcpy(&value, word->data, sizeof(value));
+    word->valid = 0;
+    return fmc_program_data(word->address, &value, 4) == word->address + 4 ? 0 : -1;
+}
+
+static flash_writer_word_t *find_partial(flash_writer_p writer, uint32_t address)
+{
+    flash_writer_word_t *free_word = NULL;
+    for (uint32_t i = 0; i < writer->partial_count; i++)
+    {
+        flash_writer_word_t *word = &writer->partial[i];
+        if (word->valid == 0)
+        {
+            free_word = free_word == NULL ? word : free_word;
+        }
+        else if (word->address == address)
+        {
+            return word;
+        }
+    }
+    if (free_word != NULL)
+    {
+        free_word->address = address;
+        memset(free_word->data, 0xFF, sizeof(free_word->data));
+    }
+    return free_word;
+}
+
+static int merge_partial(flash_writer_p writer, uint32_t address, const uint8_t *data, uint32_t size)
+{
+    uint32_t offset = address % 4;
+    flash_writer_word_t *word = find_partial(writer, address - offset);
+    if (word == NULL)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < size; i++)
+    {
+        word->data[offset + i] = data[i];
+        word->valid |= (uint8_t)(1U << (offset + i));
+    }
+    return word->valid == 0x0F ? program_partial(word) : 0;
+}
+
+void flash_writer_init(flash_writer_p writer, flash_writer_word_t *partial, uint32_t partial_count)
+{
+    memset(partial, 0, partial_count * sizeof(*partial));
+    writer->partial = partial;
+    writer->partial_count = partial_count;
+}
+
+int flash_writer_write(flash_writer_p writer, uint32_t address, const void *data, uint32_t size)
+{
+    const uint8_t *src = data;
+    uint32_t block[FLASH_WRITER_BLOCK / 4];
+    int ret = 0;
+
+    while (size > 0)
+    {
+        uint32_t len;
+        if (address % 4 != 0 || size < 4)
+        {
+            len = 4 - address % 4;
+            len = len < size ? len : size;
+            if (merge_partial(writer, address, src, len) != 0)
+            {
+                ret = -1;
+            }
+        }
+        else
+        {
+            len = size & ~3U;
+            len = len < sizeof(block) ? len : sizeof(block);
+            memcpy(block, src, len);
+            if (fmc_program_data(address, block, len) != address + len)
+            {
+                ret = -1;
+            }
+        }
+        address += len;
+        src += len;
+        size -= len;
+    }
+    return ret;
+}
+
+int flash_writer_flush(flash_writer_p writer)
+{
+    int ret = 0;
+    for (uint32_t i = 0; i < writer->partial_count; i++)
+    {
+        if (writer->partial[i].valid != 0 && program_partial(&writer->partial[i]) != 0)
+        {
+            ret = -1;
+        }
+    }
+    return ret;
+}
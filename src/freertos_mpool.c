@@ -1,11 +1,40 @@
 #include "freertos_mpool.h"
 
+os_pool_p osPoolInitStatic(os_pool_p pool_id,
+                           void *pool,
+                           uint8_t *markers,
+                           uint32_t pool_sz,
+                           uint32_t item_sz)
+{
+    uint32_t i;
+
+    pool_id->pool = pool;
+    pool_id->markers = markers;
+    pool_id->pool_sz = pool_sz;
+    pool_id->item_sz = OS_POOL_ITEM_SIZE(item_sz);
+    pool_id->used = 0;
+    pool_id->max_used = 0;
+    pool_id->failures = 0;
+    memset(markers, 0, pool_sz);
+
+    /* chain the blocks in address order, the first allocation gets the lowest one */
+    pool_id->free_list = NULL;
+    for (i = pool_sz; i > 0; i--)
+    {
+        void **block = (void **)((size_t)pool + (i - 1) * pool_id->item_sz);
+        *block = pool_id->free_list;
+        pool_id->free_list = block;
+    }
+    return pool_id;
+}
+
 os_pool_p osPoolInit(void *pool,
                      uint8_t *markers,
                      uint32_t pool_sz,
                      uint32_t item_sz)
 {
     os_pool_p pool_id = pvPortMalloc(sizeof(os_pool_t));
+    void *own_pool = NULL;
 
     if (!pool_id)
     {
@@ -14,12 +43,13 @@ os_pool_p osPoolInit(void *pool,
 
     if (!pool)
     {
-        pool = pvPortMalloc(item_sz * pool_sz);
+        pool = own_pool = pvPortMalloc(OS_POOL_ITEM_SIZE(item_sz) * pool_sz);
         if (!pool)
         {
+            vPortFree(pool_id);
             return NULL;
         }
-        memset(pool, 0, item_sz * pool_sz);
+        memset(pool, 0, OS_POOL_ITEM_SIZE(item_sz) * pool_sz);
     }
 
     if (!markers)
@@ -27,60 +57,63 @@ os_pool_p osPoolInit(void *pool,
         markers = pvPortMalloc(pool_sz);
         if (!markers)
         {
+            vPortFree(own_pool);
+            vPortFree(pool_id);
             return NULL;
         }
     }
 
-    pool_id->pool = pool;
-    pool_id->markers = markers;
-    pool_id->pool_sz = pool_sz;
-    pool_id->item_sz = item_sz;
-    memset(markers, 0, pool_sz);
-    return pool_id;
+    return osPoolInitStatic(pool_id, pool, markers, pool_sz, item_sz);
 }
 
 void *osPoolAlloc(os_pool_p pool_id)
 {
-    void *p = NULL;
-    size_t i;
-    size_t index;
+    void **block;
+    UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
 
-    for (i = 0; i < pool_id->pool_sz; i++)
+    block = pool_id->free_list;
+    if (block)
     {
-        index = (pool_id->currentIndex + i) % pool_id->pool_sz;
-
-        if (pool_id->markers[index] == 0)
+        pool_id->free_list = *block;
+        pool_id->markers[((size_t)block - (size_t)pool_id->pool) / pool_id->item_sz] = 1;
+        if (++pool_id->used > pool_id->max_used)
         {
-            portENTER_CRITICAL();
-            pool_id->markers[index] = 1;
-            p = (void *)((size_t)(pool_id->pool) + (index * pool_id->item_sz));
-            pool_id->currentIndex = index;
-            portEXIT_CRITICAL();
-            break;
+            pool_id->max_used = pool_id->used;
         }
     }
+    else
+    {
+        pool_id->failures++;
+    }
 
-    return p;
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+    return block;
 }
 
 void osPoolFree(os_pool_p pool_id, void *block)
 {
     size_t index;
+    UBaseType_t mask;
 
-    if (block < pool_id->pool)
-        goto __exit;
-
-    index = (size_t)block - (size_t)(pool_id->pool);
-    if (index % pool_id->item_sz)
+    /* only the start of a block may go on the free list, a pointer into a
+     * block would later be handed out overlapping its neighbour */
+    if (block < pool_id->pool ||
+        ((size_t)block - (size_t)pool_id->pool) % pool_id->item_sz != 0)
         goto __exit;
 
-    index = index / pool_id->item_sz;
+    index = ((size_t)block - (size_t)pool_id->pool) / pool_id->item_sz;
     if (index >= pool_id->pool_sz)
         goto __exit;
 
-    portENTER_CRITICAL();
-    pool_id->markers[index] = 0;
-    portEXIT_CRITICAL();
+    mask = taskENTER_CRITICAL_FROM_ISR();
+    if (pool_id->markers[index])
+    {
+        pool_id->markers[index] = 0;
+        *(void **)block = pool_id->free_list;
+        pool_id->free_list = block;
+        pool_id->used--;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(mask);
 
 __exit:
     return;
@@ -60,9 +60,8 @@ void main(void)
 
 static int uart_rx_ind(size_t size, void *userdata)
 {
-    SemaphoreHandle_t *semaphore = (SemaphoreHandle_t *)userdata;
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    xSemaphoreGiveFromISR(*semaphore, &xHigherPriorityTaskWoken);
+    vTaskNotifyGiveFromISR((TaskHandle_t)userdata, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
     return 0;
 }
@@ -80,9 +79,10 @@ static xlink_context_p xlink_ctx = NULL;
 static void xlinkTask(void *parameters)
 {
     int upgrade_init(xlink_context_p context);
+    int baudrate_init(xlink_context_p context, void *uart_handle);
+    void baudrate_rx_activity(void);
     (void)parameters;
     void *uart_handle = gd32_uart_get_handle("uart1");
-    SemaphoreHandle_t uart_rx_semaphore = xSemaphoreCreateBinary();
     if (uart_handle == NULL)
     {
         vTaskDelete(NULL);
@@ -99,26 +99,26 @@ static void xlinkTask(void *parameters)
     };
     xlink_ctx = xlink_context_create(&xlink_port, uart_handle);
     upgrade_init(xlink_ctx);
-    gd32_uart_set_rx_indicate(uart_handle, uart_rx_ind, &uart_rx_semaphore);
+    baudrate_init(xlink_ctx, uart_handle);
+    gd32_uart_set_rx_indicate(uart_handle, uart_rx_ind, xTaskGetCurrentTaskHandle());
 
     for (;;)
     {
-        xSemaphoreTake(uart_rx_semaphore, portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         for (;;)
         {
-            struct dma_element *rx_block = get_rx_block(uart_handle);
-            if (rx_block == NULL)
+            const uint8_t *rx_data;
+            size_t rx_size = gd32_uart_rx_span(uart_handle, &rx_data);
+            if (rx_size == 0)
             {
                 break;
             }
-            uint8_t *data = rx_block->buffer;
-            size_t size = rx_block->size;
-            for (size_t i = 0; i < size; i++)
+            // parse in place, then hand the bytes back to the DMA ring
+            if (xlink_process_rx_buffer(xlink_ctx, rx_data, rx_size) > 0)
             {
-                xlink_process_rx(xlink_ctx, data[i]);
+                baudrate_rx_activity();
             }
-            // release rx_block
-            free_rx_block(uart_handle, rx_block);
+            gd32_uart_rx_consume(uart_handle, rx_size);
         }
     }
 }
@@ -1,3 +1,5 @@
+#include <FreeRTOS.h>
+#include <task.h>
 #include "onchip_flash_port.h"
 #include "config.h"
 #include "gd32c10x.h"
@@ -8,34 +10,61 @@ static const uint32_t FMC_FLAGS = FMC_FLAG_END | FMC_FLAG_WPERR | FMC_FLAG_PGAER
 static const uint32_t FMC_FLAGS = FMC_FLAG_BANK0_END | FMC_FLAG_BANK0_WPERR | FMC_FLAG_BANK0_PGERR;
 #endif
 
-void fmc_erase_pages(uint32_t page_address, uint32_t page_num)
+/*
+ * Interrupts are masked only around a single FMC command, not for the whole
+ * operation, so the UART and the other tasks are served between pages and
+ * words. Code fetches still stall while the FMC is busy on this single bank
+ * part, but pending interrupts are taken as soon as a command completes.
+ */
+static fmc_state_enum fmc_erase_one_page(uint32_t page_address)
 {
-    uint32_t EraseCounter;
     fmc_state_enum state;
 
-    asm volatile("cpsid i"); /* close interrupt */
-
-    /* unlock the flash program/erase controller */
+    taskENTER_CRITICAL();
     fmc_unlock();
+    fmc_flag_clear(FMC_FLAGS);
+    state = fmc_page_erase(page_address);
+    fmc_flag_clear(FMC_FLAGS);
+    fmc_lock();
+    taskEXIT_CRITICAL();
 
-    /* clear all pending flags */
+    return state;
+}
+
+static fmc_state_enum fmc_program_one_word(uint32_t address, uint32_t data)
+{
+    fmc_state_enum state;
+
+    taskENTER_CRITICAL();
+    fmc_unlock();
+    state = fmc_word_program(address, data);
     fmc_flag_clear(FMC_FLAGS);
+    fmc_lock();
+    taskEXIT_CRITICAL();
+
+    return state;
+}
+
+int fmc_erase_pages(uint32_t page_address, uint32_t page_num)
+{
+    uint32_t EraseCounter;
 
     /* erase the flash pages */
     for (EraseCounter = 0; EraseCounter < page_num; EraseCounter++)
     {
-        state = fmc_page_erase(page_address + (PAGE_SIZE * EraseCounter));
-        if (FMC_READY != state)
+        if (FMC_READY != fmc_erase_one_page(page_address + (PAGE_SIZE * EraseCounter)))
         {
-            break;
+            return -1;
         }
-        fmc_flag_clear(FMC_FLAGS);
-    }
 
-    /* lock the main FMC after the erase operation */
-    fmc_lock();
+        /* let tasks of the same priority run between pages */
+        if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+        {
+            taskYIELD();
+        }
+    }
 
-    asm volatile("cpsie i"); /* open interrupt */
+    return 0;
 }
 
 int fmc_erase_pages_check(uint32_t page_address, uint32_t page_num)
@@ -63,24 +92,16 @@ uint32_t fmc_program_data(uint32_t address, void *data, uint32_t size)
 {
     uint32_t i;
 
-    asm volatile("cpsid i"); /* close interrupt */
-
-    /* unlock the flash program/erase controller */
-    fmc_unlock();
-
     /* program flash */
     for (i = 0; i < size / 4; i++)
     {
-        fmc_word_program(address, *(uint32_t *)data);
+        if (FMC_READY != fmc_program_one_word(address, *(uint32_t *)data))
+        {
+            break;
+        }
         data = (void *)((uint8_t *)data + 4);
         address += 4;
-        fmc_flag_clear(FMC_FLAGS);
     }
 
-    /* lock the main FMC after the program operation */
-    fmc_lock();
-
-    asm volatile("cpsie i"); /* open interrupt */
-
     return address;
 }
@@ -1,12 +1,310 @@
+#include <FreeRTOS.h>
+#include <task.h>
+#include <queue.h>
+#include <semphr.h>
+#include "config.h"
 #include "xlink_upgrade.h"
 #include "partition.h"
 #include "gd32c10x.h"
 #include "onchip_flash_port.h"
+#include "flash_writer.h"
+#include "lzss.h"
 
 static uint32_t start_address;
 static uint32_t size_bytes;
 static uint32_t chunk_size;
-static uint32_t check_crc32;
+static xlink_upgrade_flag_t upgrade_flags;
+
+#define FLASH_END_ADDRESS (PARTITION_ADDRESS_PARAMS + PARTITION_SIZE_PARAMS)
+#define FLASH_TOTAL_PAGES ((FLASH_END_ADDRESS - PARTITION_ADDRESS_BOOTLOADER) / PAGE_SIZE)
+
+/*
+ * Pages of the current session erased so far. Every session erases a page just
+ * before the first chunk lands in it, so StartFirmwareUpgrade returns at once.
+ * Pages never written are erased at finalize, except with
+ * XLINK_UPGRADE_FLAG_PAGE_ERASE where they keep their contents.
+ */
+static uint32_t erased_pages[(FLASH_TOTAL_PAGES + 31) / 32];
+
+/* chunks of any length and offset are combined into whole word programs */
+static flash_writer_t writer;
+
+/*
+ * Chunk offsets of the current session already queued for programming. The
+ * host resends a chunk whose response was lost or late; programming its words
+ * a second time would fail on the FMC, so a duplicate is only acked again.
+ */
+#define UPGRADE_MIN_CHUNK_SIZE 64
+#define UPGRADE_MAX_CHUNKS ((FLASH_END_ADDRESS - PARTITION_ADDRESS_BOOTLOADER) / UPGRADE_MIN_CHUNK_SIZE)
+static uint32_t admitted_chunks[(UPGRADE_MAX_CHUNKS + 31) / 32];
+
+#define UPGRADE_STAGE_SIZE 256
+
+/*
+ * Decoder state of a XLINK_UPGRADE_FLAG_COMPRESSED session, allocated from the
+ * FreeRTOS heap only while such a session is running. Chunk offsets are
+ * sequence numbers of the compressed stream and must arrive in order.
+ */
+typedef struct upgrade_stream_def
+{
+    lzss_decoder_t decoder;
+    uint8_t stage[UPGRADE_STAGE_SIZE]; // decoded bytes waiting to be programmed
+    uint32_t stage_len;
+    uint32_t written;     // decoded bytes programmed so far
+    uint32_t next_offset; // next chunk the rx task admits
+} upgrade_stream_t;
+
+static upgrade_stream_t *stream;
+
+/*
+ * Chunks are programmed by upgrade_flash_task so the xlink task keeps parsing
+ * while the FMC is busy. The rx side validates a chunk, copies it into a free
+ * job and acks it once queued; a NULL job is a barrier that the flash task
+ * answers on flush_done after everything queued before it is programmed.
+ */
+#define UPGRADE_JOB_COUNT 4
+/* how long a chunk waits for a free job before it is rejected */
+#define UPGRADE_JOB_WAIT_MS 100
+
+typedef struct upgrade_job_def
+{
+    uint32_t offset;
+    uint8_t data_len;
+    uint8_t data[XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN];
+} upgrade_job_t;
+
+static QueueHandle_t free_jobs;
+static QueueHandle_t pending_jobs;
+static SemaphoreHandle_t flush_done;
+/* set by the flash task when programming failed, checked at finalize */
+static volatile bool session_error;
+
+/*
+ * A chunk edge that is not word aligned leaves a partial word in the writer
+ * until the neighbouring chunk arrives. A host keeping the advertised window
+ * has at most UPGRADE_JOB_COUNT chunks missing below the highest one it sent,
+ * two edges each, plus the edge above that chunk and the image tail. A plain
+ * session chunk that would open more edges than the writer holds is rejected
+ * and the host resends it once the chunks below it have closed some.
+ */
+#define UPGRADE_PARTIAL_WORDS (2 * UPGRADE_JOB_COUNT + 2)
+static flash_writer_word_t partial_words[UPGRADE_PARTIAL_WORDS];
+static int open_edges; // partial words the admitted chunks leave in the writer
+
+#define journal ((const UpgradeJournal_t *)PARTITION_ADDRESS_UPGRADE_JOURNAL)
+
+/* pages of the current session are recorded in the journal */
+static bool journal_active;
+
+static bool journal_matches(uint32_t session_id, uint32_t address, uint32_t size)
+{
+    return session_id != 0 &&
+           journal->magicNumber == PARTITION_MAGIC_NUMBER &&
+           journal->session_id == session_id &&
+           journal->start_address == address &&
+           journal->size_bytes == size;
+}
+
+static int journal_erase(void)
+{
+    if (fmc_erase_pages_check(PARTITION_ADDRESS_UPGRADE_JOURNAL, 1) == 0)
+    {
+        return 0;
+    }
+    return fmc_erase_pages(PARTITION_ADDRESS_UPGRADE_JOURNAL, 1);
+}
+
+static int journal_begin(uint32_t session_id)
+{
+    uint32_t header[3] = {session_id, start_address, size_bytes};
+    uint32_t magic = PARTITION_MAGIC_NUMBER;
+    uint32_t address = PARTITION_ADDRESS_UPGRADE_JOURNAL + offsetof(UpgradeJournal_t, session_id);
+    /* a session that covers the journal page can not be journaled */
+    if (size_to_pages(size_bytes) > UPGRADE_JOURNAL_MAX_PAGES ||
+        start_address + size_bytes > PARTITION_ADDRESS_UPGRADE_JOURNAL ||
+        fmc_program_data(address, header, sizeof(header)) != address + sizeof(header) ||
+        fmc_program_data(PARTITION_ADDRESS_UPGRADE_JOURNAL, &magic, sizeof(magic)) != PARTITION_ADDRESS_UPGRADE_JOURNAL + sizeof(magic))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* a lost mark only makes the host send that page again */
+static void journal_mark(uint32_t page)
+{
+    uint32_t zero = 0;
+    uint32_t address = PARTITION_ADDRESS_UPGRADE_JOURNAL + offsetof(UpgradeJournal_t, pages) + page * sizeof(uint32_t);
+    if (journal_active && journal->pages[page] == 0xFFFFFFFF)
+    {
+        fmc_program_data(address, &zero, sizeof(zero));
+    }
+}
+
+static bool erase_touched_pages(uint32_t address, uint32_t size)
+{
+    if (size == 0)
+    {
+        return true;
+    }
+    uint32_t page = (address - start_address) / PAGE_SIZE;
+    uint32_t last = (address + size - 1 - start_address) / PAGE_SIZE;
+    for (; page <= last; page++)
+    {
+        if (erased_pages[page / 32] & (1UL << (page % 32)))
+        {
+            continue;
+        }
+        /* reading a blank page back is much cheaper than erasing it */
+        if (fmc_erase_pages_check(start_address + page * PAGE_SIZE, 1) != 0 &&
+            fmc_erase_pages(start_address + page * PAGE_SIZE, 1) != 0)
+        {
+            return false;
+        }
+        erased_pages[page / 32] |= 1UL << (page % 32);
+        journal_mark(page);
+    }
+    return true;
+}
+
+static bool erase_untouched_pages(void)
+{
+    for (uint32_t page = 0; page < size_to_pages(size_bytes); page++)
+    {
+        if (!erase_touched_pages(start_address + page * PAGE_SIZE, 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool stream_program_stage(void)
+{
+    uint32_t len = stream->stage_len;
+    if (len > size_bytes - stream->written)
+    {
+        return false;
+    }
+    uint32_t address = start_address + stream->written;
+    if (!erase_touched_pages(address, len) ||
+        flash_writer_write(&writer, address, stream->stage, len) != 0)
+    {
+        return false;
+    }
+    stream->written += len;
+    stream->stage_len = 0;
+    return true;
+}
+
+static bool stream_decode(const uint8_t *data, size_t len)
+{
+    for (;;)
+    {
+        stream->stage_len += lzss_decode(&stream->decoder,
+                                         &data,
+                                         &len,
+                                         stream->stage + stream->stage_len,
+                                         UPGRADE_STAGE_SIZE - stream->stage_len);
+        if (stream->stage_len < UPGRADE_STAGE_SIZE)
+        {
+            return true; // input used up
+        }
+        if (!stream_program_stage())
+        {
+            return false;
+        }
+    }
+}
+
+static void stream_free(void)
+{
+    if (stream != NULL)
+    {
+        vPortFree(stream);
+        stream = NULL;
+    }
+}
+
+static bool program_job(const upgrade_job_t *job)
+{
+    if (stream != NULL)
+    {
+        return stream_decode(job->data, job->data_len);
+    }
+    uint32_t write_address = start_address + job->offset * chunk_size;
+    return erase_touched_pages(write_address, job->data_len) &&
+           flash_writer_write(&writer, write_address, job->data, job->data_len) == 0;
+}
+
+static void upgrade_flash_task(void *parameters)
+{
+    (void)parameters;
+    for (;;)
+    {
+        upgrade_job_t *job;
+        xQueueReceive(pending_jobs, &job, portMAX_DELAY);
+        if (job == NULL)
+        {
+            xSemaphoreGive(flush_done);
+            continue;
+        }
+        if (!session_error && !program_job(job))
+        {
+            session_error = true;
+        }
+        xQueueSend(free_jobs, &job, 0);
+    }
+}
+
+/* wait until every chunk queued so far is programmed, the session state is then safe to touch */
+static void upgrade_flush(void)
+{
+    upgrade_job_t *barrier = NULL;
+    xQueueSend(pending_jobs, &barrier, portMAX_DELAY);
+    xSemaphoreTake(flush_done, portMAX_DELAY);
+}
+
+static bool chunk_admitted(uint32_t offset)
+{
+    return (admitted_chunks[offset / 32] & (1UL << (offset % 32))) != 0;
+}
+
+/* change of open_edges once a plain session chunk is programmed */
+static int chunk_edge_delta(uint32_t offset, uint32_t len)
+{
+    uint32_t begin = offset * chunk_size;
+    uint32_t end = begin + len;
+    int delta = 0;
+    if (begin % 4 != 0)
+    {
+        delta += chunk_admitted(offset - 1) ? -1 : 1;
+    }
+    if (end % 4 != 0)
+    {
+        /* the image tail is only closed by the flush at finalize */
+        delta += end < size_bytes && chunk_admitted(offset + 1) ? -1 : 1;
+    }
+    return delta;
+}
+
+static bool queue_chunk(const xlink_upgrade_firmware_chunk_t *msg)
+{
+    upgrade_job_t *job;
+    if (xQueueReceive(free_jobs, &job, pdMS_TO_TICKS(UPGRADE_JOB_WAIT_MS)) != pdTRUE)
+    {
+        return false;
+    }
+    job->offset = msg->offset;
+    job->data_len = msg->data_len;
+    memcpy(job->data, msg->data, msg->data_len);
+    xQueueSend(pending_jobs, &job, portMAX_DELAY);
+    return true;
+}
+
+#define BOOTLOADER_VERSION 0x00010001
+#define BOOTLOADER_COMMIT_HASH 0x12345678
+#define BOOTLOADER_COMPILE_TIMESTAMP 0x12345678
 
 static int GetFirmwareInfo_cb(uint8_t comp_id,
                               uint8_t msg_id,
@@ -14,9 +312,6 @@ static int GetFirmwareInfo_cb(uint8_t comp_id,
                               uint8_t payload_len,
                               void *user_data)
 {
-#define BOOTLOADER_VERSION 0x00010001
-#define BOOTLOADER_COMMIT_HASH 0x12345678
-#define BOOTLOADER_COMPILE_TIMESTAMP 0x12345678
     extern uint32_t __gVectors[];
     xlink_upgrade_get_firmware_info_t *msg = (xlink_upgrade_get_firmware_info_t *)payload;
     xlink_partition_type_t partition_type;
@@ -24,6 +319,7 @@ static int GetFirmwareInfo_cb(uint8_t comp_id,
     switch (msg->required_partition)
     {
     case XLINK_PARTITION_TYPE_BOOTLOADER:
+        partition_type = XLINK_PARTITION_TYPE_BOOTLOADER;
         version = BOOTLOADER_VERSION;
         size_bytes = 0;
         commit_hash = BOOTLOADER_COMMIT_HASH;
@@ -59,6 +355,57 @@ static int GetFirmwareInfo_cb(uint8_t comp_id,
     return 0;
 }
 
+/* everything GetFirmwareInfo reports for the three partitions plus the upgrade limits, in one frame */
+static int GetDeviceInventory_cb(uint8_t comp_id,
+                                 uint8_t msg_id,
+                                 const uint8_t *payload,
+                                 uint8_t payload_len,
+                                 void *user_data)
+{
+    extern uint32_t __gVectors[];
+    static const uint32_t partition_address[3] = {PARTITION_ADDRESS_BOOTLOADER,
+                                                  PARTITION_ADDRESS_APP_A_INFO,
+                                                  PARTITION_ADDRESS_APP_B_INFO};
+    static const uint32_t partition_size[3] = {PARTITION_SIZE_BOOTLOADER,
+                                               PARTITION_SIZE_APP_A_INFO + PARTITION_SIZE_APP_A,
+                                               PARTITION_SIZE_APP_B_INFO + PARTITION_SIZE_APP_B};
+    uint32_t version[3] = {BOOTLOADER_VERSION};
+    uint32_t size_bytes[3] = {0};
+    uint32_t commit_hash[3] = {BOOTLOADER_COMMIT_HASH};
+    uint32_t compile_timestamp[3] = {BOOTLOADER_COMPILE_TIMESTAMP};
+    xlink_partition_type_t active_partition = XLINK_PARTITION_TYPE_BOOTLOADER;
+    for (int type = XLINK_PARTITION_TYPE_APP_A; type <= XLINK_PARTITION_TYPE_APP_B; type++)
+    {
+        AppInfo_p app_info = (AppInfo_p)(size_t)partition_address[type];
+        version[type] = app_info->version;
+        size_bytes[type] = app_info->size_bytes;
+        commit_hash[type] = app_info->commit_hash;
+        compile_timestamp[type] = app_info->compile_timestamp;
+    }
+    if ((size_t)__gVectors == PARTITION_ADDRESS_APP_A)
+    {
+        active_partition = XLINK_PARTITION_TYPE_APP_A;
+    }
+    else if ((size_t)__gVectors == PARTITION_ADDRESS_APP_B)
+    {
+        active_partition = XLINK_PARTITION_TYPE_APP_B;
+    }
+    xlink_upgrade_device_inventory_send((xlink_context_p)user_data,
+                                        active_partition,
+                                        (size_t)__gVectors,
+                                        partition_address,
+                                        partition_size,
+                                        version,
+                                        size_bytes,
+                                        commit_hash,
+                                        compile_timestamp,
+                                        XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN,
+                                        UPGRADE_JOB_COUNT,
+                                        XLINK_UPGRADE_FLAG_PAGE_ERASE | XLINK_UPGRADE_FLAG_COMPRESSED | XLINK_UPGRADE_FLAG_RESUME,
+                                        BSP_UART1_BAUDRATE_MAX);
+    return 0;
+}
+
 static int StartFirmwareUpgrade_cb(uint8_t comp_id,
                                    uint8_t msg_id,
                                    const uint8_t *payload,
@@ -66,11 +413,71 @@ static int StartFirmwareUpgrade_cb(uint8_t comp_id,
                                    void *user_data)
 {
     xlink_upgrade_start_firmware_upgrade_t *msg = (xlink_upgrade_start_firmware_upgrade_t *)payload;
+    /* hosts predating the flags or session_id field send a shorter message */
+    xlink_upgrade_flag_t flags = payload_len > offsetof(xlink_upgrade_start_firmware_upgrade_t, flags) ? msg->flags : XLINK_UPGRADE_FLAG_NONE;
+    uint32_t session_id = payload_len >= sizeof(*msg) ? msg->session_id : 0;
+    if (msg->start_address < PARTITION_ADDRESS_BOOTLOADER ||
+        msg->start_address % PAGE_SIZE != 0 ||
+        msg->size_bytes > FLASH_END_ADDRESS - msg->start_address ||
+        /* offsets of a plain session index admitted_chunks, stream offsets are sequence numbers */
+        (!(flags & XLINK_UPGRADE_FLAG_COMPRESSED) &&
+         (msg->chunk_size == 0 || (msg->size_bytes + msg->chunk_size - 1) / msg->chunk_size > UPGRADE_MAX_CHUNKS)) ||
+        /* pages the host skips keep their contents, a chunk straddling into one would erase it */
+        ((flags & (XLINK_UPGRADE_FLAG_PAGE_ERASE | XLINK_UPGRADE_FLAG_RESUME)) && !(flags & XLINK_UPGRADE_FLAG_COMPRESSED) &&
+         PAGE_SIZE % msg->chunk_size != 0) ||
+        /* a resumed session only rewrites the pages the host sends, like PAGE_ERASE */
+        ((flags & XLINK_UPGRADE_FLAG_RESUME) &&
+         ((flags & XLINK_UPGRADE_FLAG_COMPRESSED) || !(flags & XLINK_UPGRADE_FLAG_PAGE_ERASE) ||
+          !journal_matches(session_id, msg->start_address, msg->size_bytes))))
+    {
+        xlink_upgrade_start_firmware_upgrade_response_send((xlink_context_p)user_data,
+                                                           false);
+        return -1;
+    }
+    /* chunks of an earlier session may still be queued */
+    upgrade_flush();
+    if (msg->start_address < PARTITION_ADDRESS_PARAMS &&
+        msg->start_address + msg->size_bytes > PARTITION_ADDRESS_APP_A_INFO &&
+        fmc_erase_pages_check(PARTITION_ADDRESS_BOOT_RECORDS, size_to_pages(PARTITION_SIZE_BOOT_RECORDS)) != 0)
+    {
+        /* the bootloader must not trust a cached check of a slot being rewritten */
+        fmc_erase_pages(PARTITION_ADDRESS_BOOT_RECORDS, size_to_pages(PARTITION_SIZE_BOOT_RECORDS));
+    }
+    session_error = false;
     start_address = msg->start_address;
     size_bytes = msg->size_bytes;
     chunk_size = msg->chunk_size;
-    check_crc32 = XLINK_INIT_CRC16;
-    fmc_erase_pages(start_address, size_to_pages(size_bytes));
+    upgrade_flags = flags;
+    stream_free();
+    if (flags & XLINK_UPGRADE_FLAG_RESUME)
+    {
+        journal_active = true;
+    }
+    else
+    {
+        /* a compressed stream can not be picked up halfway, it is not journaled */
+        journal_active = false;
+        if (journal_erase() == 0 && session_id != 0 && !(flags & XLINK_UPGRADE_FLAG_COMPRESSED))
+        {
+            journal_active = journal_begin(session_id) == 0;
+        }
+    }
+    if (upgrade_flags & XLINK_UPGRADE_FLAG_COMPRESSED)
+    {
+        stream = pvPortMalloc(sizeof(upgrade_stream_t));
+        if (stream == NULL)
+        {
+            xlink_upgrade_start_firmware_upgrade_response_send((xlink_context_p)user_data,
+                                                               false);
+            return -1;
+        }
+        memset(stream, 0, sizeof(upgrade_stream_t));
+        lzss_decoder_init(&stream->decoder);
+    }
+    memset(erased_pages, 0, sizeof(erased_pages));
+    memset(admitted_chunks, 0, sizeof(admitted_chunks));
+    open_edges = 0;
+    flash_writer_init(&writer, partial_words, UPGRADE_PARTIAL_WORDS);
     xlink_upgrade_start_firmware_upgrade_response_send((xlink_context_p)user_data,
                                                        true);
     return 0;
@@ -83,21 +490,49 @@ static int FirmwareChunk_cb(uint8_t comp_id,
                             void *user_data)
 {
     xlink_upgrade_firmware_chunk_t *msg = (xlink_upgrade_firmware_chunk_t *)payload;
-    size_t write_address = start_address + msg->offset * chunk_size;
-    size_t write_size = msg->data_len;
-    if (write_address + write_size > start_address + size_bytes)
+    bool accepted;
+    if (payload_len < offsetof(xlink_upgrade_firmware_chunk_t, data) ||
+        msg->data_len > payload_len - offsetof(xlink_upgrade_firmware_chunk_t, data) ||
+        session_error)
     {
-        xlink_upgrade_firmware_chunk_response_send((xlink_context_p)user_data,
-                                                   msg->offset,
-                                                   false);
-        return -1;
+        accepted = false;
+    }
+    else if (stream != NULL)
+    {
+        if (msg->offset == stream->next_offset)
+        {
+            accepted = queue_chunk(msg);
+            stream->next_offset += accepted ? 1 : 0;
+        }
+        else
+        {
+            /* ack a resent chunk that was already queued, reject a gap so the host resends in order */
+            accepted = msg->offset < stream->next_offset;
+        }
+    }
+    else if (msg->offset >= UPGRADE_MAX_CHUNKS ||
+             (size_t)msg->offset * chunk_size + msg->data_len > size_bytes)
+    {
+        accepted = false;
+    }
+    else if (chunk_admitted(msg->offset))
+    {
+        accepted = true; // resent after a lost response, already queued
+    }
+    else
+    {
+        int delta = chunk_edge_delta(msg->offset, msg->data_len);
+        accepted = open_edges + delta <= UPGRADE_PARTIAL_WORDS && queue_chunk(msg);
+        if (accepted)
+        {
+            admitted_chunks[msg->offset / 32] |= 1UL << (msg->offset % 32);
+            open_edges += delta;
+        }
     }
-    fmc_program_data(write_address, msg->data, write_size);
-    check_crc32 = xlink_crc16_with_init(msg->data, write_size, check_crc32);
     xlink_upgrade_firmware_chunk_response_send((xlink_context_p)user_data,
                                                msg->offset,
-                                               true);
-    return 0;
+                                               accepted);
+    return accepted ? 0 : -1;
 }
 
 static int FinalizeFirmwareUpgrade_cb(uint8_t comp_id,
@@ -107,12 +542,96 @@ static int FinalizeFirmwareUpgrade_cb(uint8_t comp_id,
                                       void *user_data)
 {
     xlink_upgrade_finalize_firmware_upgrade_t *msg = (xlink_upgrade_finalize_firmware_upgrade_t *)payload;
-    bool success = (msg->expected_crc32 == check_crc32);
+    upgrade_flush();
+    bool success = !session_error;
+    if (stream != NULL)
+    {
+        success = success &&
+                  (stream->stage_len == 0 || stream_program_stage()) &&
+                  stream->written == size_bytes;
+        stream_free();
+    }
+    success = flash_writer_flush(&writer) == 0 && success;
+    if (!(upgrade_flags & XLINK_UPGRADE_FLAG_PAGE_ERASE))
+    {
+        /* chunks skipped by the host, e.g. sparse 0xFF runs, must still read back erased */
+        success = erase_untouched_pages() && success;
+    }
+    success = success &&
+              (msg->expected_crc32 == crc32_calculate((const uint8_t *)(uintptr_t)start_address, size_bytes, 0));
+    if (success && journal_active)
+    {
+        journal_active = false;
+        journal_erase();
+    }
     xlink_upgrade_finalize_firmware_upgrade_response_send((xlink_context_p)user_data,
                                                           success);
     return 0;
 }
 
+static int GetPageDigests_cb(uint8_t comp_id,
+                             uint8_t msg_id,
+                             const uint8_t *payload,
+                             uint8_t payload_len,
+                             void *user_data)
+{
+    static uint32_t digests[sizeof(((xlink_upgrade_page_digests_t *)0)->digests) / sizeof(uint32_t)];
+    xlink_upgrade_get_page_digests_t *msg = (xlink_upgrade_get_page_digests_t *)payload;
+    uint32_t address = msg->start_address;
+    uint8_t page_count = msg->page_count;
+    if (address < PARTITION_ADDRESS_BOOTLOADER ||
+        address % PAGE_SIZE != 0 ||
+        page_count > sizeof(digests) / sizeof(digests[0]) ||
+        (uint32_t)page_count * PAGE_SIZE > FLASH_END_ADDRESS - address)
+    {
+        page_count = 0;
+    }
+    memset(digests, 0, sizeof(digests));
+    for (uint8_t i = 0; i < page_count; i++)
+    {
+        digests[i] = crc32_calculate((const uint8_t *)(uintptr_t)(address + i * PAGE_SIZE), PAGE_SIZE, 0);
+    }
+    xlink_upgrade_page_digests_send((xlink_context_p)user_data,
+                                    address,
+                                    page_count,
+                                    digests);
+    return 0;
+}
+
+static int GetSessionProgress_cb(uint8_t comp_id,
+                                 uint8_t msg_id,
+                                 const uint8_t *payload,
+                                 uint8_t payload_len,
+                                 void *user_data)
+{
+    static uint8_t written[sizeof(((xlink_upgrade_session_progress_t *)0)->written)];
+    uint32_t page_count = 0;
+    memset(written, 0, sizeof(written));
+    if (journal->magicNumber == PARTITION_MAGIC_NUMBER)
+    {
+        page_count = size_to_pages(journal->size_bytes);
+        if (page_count > sizeof(written) * 8)
+        {
+            page_count = sizeof(written) * 8;
+        }
+        for (uint32_t page = 0; page < page_count; page++)
+        {
+            if (journal->pages[page] == 0)
+            {
+                written[page / 8] |= 1U << (page % 8);
+            }
+        }
+    }
+    /* an erased journal reports session 0, no session to resume */
+    xlink_upgrade_session_progress_send((xlink_context_p)user_data,
+                                        page_count ? journal->session_id : 0,
+                                        page_count ? journal->start_address : 0,
+                                        page_count ? journal->size_bytes : 0,
+                                        (uint8_t)page_count,
+                                        written);
+    return 0;
+}
+
 static int RestartDevice_cb(uint8_t comp_id,
                             uint8_t msg_id,
                             const uint8_t *payload,
@@ -125,6 +644,29 @@ static int RestartDevice_cb(uint8_t comp_id,
 
 int upgrade_init(xlink_context_p context)
 {
+    upgrade_job_t *jobs = pvPortMalloc(sizeof(upgrade_job_t) * UPGRADE_JOB_COUNT);
+    free_jobs = xQueueCreate(UPGRADE_JOB_COUNT, sizeof(upgrade_job_t *));
+    /* one extra entry so a barrier always fits behind a full pool */
+    pending_jobs = xQueueCreate(UPGRADE_JOB_COUNT + 1, sizeof(upgrade_job_t *));
+    flush_done = xSemaphoreCreateBinary();
+    if (jobs == NULL || free_jobs == NULL || pending_jobs == NULL || flush_done == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < UPGRADE_JOB_COUNT; i++)
+    {
+        upgrade_job_t *job = &jobs[i];
+        xQueueSend(free_jobs, &job, 0);
+    }
+    if (xTaskCreate(upgrade_flash_task,
+                    "upgrade_flash",
+                    configMINIMAL_STACK_SIZE * 2,
+                    NULL,
+                    tskIDLE_PRIORITY + 1U,
+                    NULL) != pdPASS)
+    {
+        return -1;
+    }
 
     xlink_register_msg_handler(context,
                                XLINK_COMP_ID_UPGRADE,
@@ -153,6 +695,21 @@ int upgrade_init(xlink_context_p context)
                                XLINK_UPGRADE_MSG_ID_RESTART_DEVICE,
                                RestartDevice_cb,
                                context);
+    xlink_register_msg_handler(context,
+                               XLINK_COMP_ID_UPGRADE,
+                               XLINK_UPGRADE_MSG_ID_GET_PAGE_DIGESTS,
+                               GetPageDigests_cb,
+                               context);
+    xlink_register_msg_handler(context,
+                               XLINK_COMP_ID_UPGRADE,
+                               XLINK_UPGRADE_MSG_ID_GET_DEVICE_INVENTORY,
+                               GetDeviceInventory_cb,
+                               context);
+    xlink_register_msg_handler(context,
+                               XLINK_COMP_ID_UPGRADE,
+                               XLINK_UPGRADE_MSG_ID_GET_SESSION_PROGRESS,
+                               GetSessionProgress_cb,
+                               context);
 
     return 0;
 }
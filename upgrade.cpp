@@ -1,25 +1,36 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <string>
 #include <fcntl.h>
 #include <termios.h>
-#include <thread>
 #include <chrono>
 #include <vector>
+#include <set>
+#include <map>
+#include <errno.h>
 #include <signal.h>
+#include <glob.h>
+#include <sys/epoll.h>
+#include <memory>
 
 #include "xlink.h"
 #include "xlink_port_posix.h"
 #include "xlink_port_stdlib.h"
 #include "xlink_upgrade.h"
 #include "partition.h"
+#include "onchip_flash_port.h"
+#include "lzss.h"
 
 using namespace std;
 
-static int get_mcu_firmware_version(xlink_context_p ctx, xlink_partition_type_t partition_type, xlink_upgrade_firmware_info_t *out_info);
+#define SERIAL_LINE_BAUDRATE 115200
+#define SERIAL_BITS_PER_BYTE 10 // start + 8 data + stop
+
+#define INVENTORY_TIMEOUT_MS 100
 
 static void _close(int sig)
 {
@@ -57,14 +68,34 @@ static int xlink_transport_send(void *transport_handle, xlink_frame_t *frame)
     return ret;
 }
 
+static xlink_port_api_t host_port = {
+    .malloc_fn = xlink_stdlib_malloc,
+    .free_fn = xlink_stdlib_free,
+    .mutex_create_fn = xlink_posix_mutex_create,
+    .mutex_delete_fn = xlink_posix_mutex_delete,
+    .mutex_lock_fn = xlink_posix_mutex_lock,
+    .mutex_unlock_fn = xlink_posix_mutex_unlock,
+    .transport_send_fn = xlink_transport_send,
+    .frame_send_alloc_fn = xlink_frame_send_alloc,
+};
+
 static void usage(void)
 {
     printf(
         "Usage: -d /path/to/device -f /path/to/file\n"
         "-h, --help             display this help and exit\n"
         "-s, --show             show device information\n"
-        "-d, --device           device file path\n"
-        "-f, --file             file path\n");
+        "-d, --device           device file path, repeat it or give a quoted glob\n"
+        "                       such as '/dev/ttyUSB*' to upgrade several devices\n"
+        "-j, --jobs             devices upgraded at the same time, default 8\n"
+        "-f, --file             file path\n"
+        "-w, --window           number of firmware chunks in flight, default 1,\n"
+        "                       the device queues up to 4 chunks for programming\n"
+        "-S, --sparse           skip chunks that are entirely erased (0xFF)\n"
+        "-D, --diff             only program pages that differ from the device\n"
+        "-z, --compress         send the image LZSS compressed\n"
+        "-b, --baudrate         highest baudrate to negotiate for the transfer, e.g. 2000000,\n"
+        "                       the line starts and ends at 115200\n");
 }
 
 static void serial_set_param(int fd, int baudrate)
@@ -87,266 +118,1263 @@ static void serial_set_param(int fd, int baudrate)
     tcsetattr(fd, TCSANOW, &param);
 }
 
-class upgrade_partition
+struct latency_stats
+{
+    unsigned long count = 0;
+    long long total_us = 0;
+    long long min_us = 0;
+    long long max_us = 0;
+
+    void add(long long us)
+    {
+        min_us = (count == 0 || us < min_us) ? us : min_us;
+        max_us = us > max_us ? us : max_us;
+        total_us += us;
+        count++;
+    }
+
+    void print(const char *what) const
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        printf("%s latency: min %lld us, avg %lld us, max %lld us over %lu responses\n",
+               what, min_us, total_us / (long long)count, max_us, count);
+    }
+};
+
+// rates tried by -b, fastest first, that the GD32C103 USART divides within 2%
+static const uint32_t baudrate_candidates[] = {2000000, 1500000, 1000000, 921600, 460800, 230400};
+#define BAUDRATE_CONFIRM_TIMEOUT_MS 500 // the device falls back to the default rate after it
+#define BAUDRATE_RESPONSE_TIMEOUT_MS 500
+#define BAUDRATE_CONFIRM_ATTEMPTS 3
+#define BAUDRATE_CONFIRM_WAIT_MS 100
+
+static speed_t baudrate_speed(uint32_t baudrate)
+{
+    switch (baudrate)
+    {
+    case 115200:
+        return B115200;
+    case 230400:
+        return B230400;
+    case 460800:
+        return B460800;
+    case 921600:
+        return B921600;
+    case 1000000:
+        return B1000000;
+    case 1500000:
+        return B1500000;
+    case 2000000:
+        return B2000000;
+    default:
+        return B0;
+    }
+}
+
+// largest chunk that divides a flash page, so no chunk straddles two pages
+static size_t page_chunk_size()
+{
+    size_t len = XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN;
+    while (PAGE_SIZE % len != 0)
+    {
+        len--;
+    }
+    return len;
+}
+
+// the same image at the same address gets the same id on every run, 0 means no session
+static uint32_t image_session_id(const vector<uint8_t> &image, uint32_t start_address)
+{
+    uint32_t id = crc32_calculate(image.data(), image.size(), start_address);
+    return id != 0 ? id : 1;
+}
+
+// the device hashes whole pages, pad the image tail the way it reads back erased flash
+static uint32_t image_page_crc(const vector<uint8_t> &image, size_t page)
+{
+    uint8_t page_data[PAGE_SIZE];
+    size_t pos = page * PAGE_SIZE;
+    memset(page_data, 0xFF, PAGE_SIZE);
+    memcpy(page_data, &image[pos], min((size_t)PAGE_SIZE, image.size() - pos));
+    return crc32_calculate(page_data, PAGE_SIZE, 0);
+}
+
+static bool session_page_written(const xlink_upgrade_session_progress_t &progress, size_t page)
+{
+    return page < progress.page_count && (progress.written[page / 8] & (1U << (page % 8))) != 0;
+}
+
+// does the journal on the device belong to this image, and has any page been written yet
+static bool session_resumable(const xlink_upgrade_session_progress_t &progress, const vector<uint8_t> &image, uint32_t start_address)
+{
+    if (progress.session_id != image_session_id(image, start_address) ||
+        progress.start_address != start_address ||
+        progress.size_bytes != image.size() ||
+        progress.page_count != size_to_pages(image.size()))
+    {
+        return false;
+    }
+    for (size_t page = 0; page < progress.page_count; page++)
+    {
+        if (session_page_written(progress, page))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// pages to send: not written by the interrupted session, or written but not matching the image
+static set<uint32_t> session_pages_to_send(const xlink_upgrade_session_progress_t &progress, const vector<uint8_t> &image, const vector<uint32_t> &digests)
+{
+    set<uint32_t> pages;
+    for (size_t page = 0; page < size_to_pages(image.size()); page++)
+    {
+        if (page >= digests.size() || !session_page_written(progress, page) || image_page_crc(image, page) != digests[page])
+        {
+            pages.insert((uint32_t)page);
+        }
+    }
+    return pages;
+}
+
+// read a partition of a full flash image, app slots only up to the end of the image their info page describes
+static bool read_partition_image(int fd, xlink_partition_type_t type, uint32_t start_address, uint32_t size_bytes, vector<uint8_t> &data)
+{
+    if (lseek(fd, start_address - PARTITION_ADDRESS_BOOTLOADER, SEEK_SET) < 0)
+    {
+        return false;
+    }
+    data.resize(size_bytes);
+    if (read(fd, data.data(), size_bytes) != (ssize_t)size_bytes)
+    {
+        data.clear();
+        return false;
+    }
+    if (type != XLINK_PARTITION_TYPE_BOOTLOADER)
+    {
+        const AppInfo_t *app_info = (const AppInfo_t *)data.data();
+        if (app_info->magicNumber == PARTITION_MAGIC_NUMBER &&
+            app_info->size_bytes <= size_bytes - PARTITION_SIZE_APP_A_INFO)
+        {
+            data.resize(PARTITION_SIZE_APP_A_INFO + app_info->size_bytes);
+        }
+    }
+    return true;
+}
+
+static BootFromInfo_t make_boot_from_info(xlink_partition_type_t target_partition)
+{
+    BootFromInfo_t boot_from_info;
+    boot_from_info.magicNumber = PARTITION_MAGIC_NUMBER;
+    boot_from_info.activeApp = target_partition == XLINK_PARTITION_TYPE_APP_A ? ACTIVE_APP_A : ACTIVE_APP_B;
+    memset(boot_from_info.reserved, 0, sizeof(boot_from_info.reserved));
+    boot_from_info.checksum = 0; // Assume checksum is calculated elsewhere
+    return boot_from_info;
+}
+
+static void print_device_inventory(const xlink_upgrade_device_inventory_t &inventory)
+{
+    const char *partition_str[] = {"BOOTLOADER", "APP_A", "APP_B"};
+    for (size_t type = XLINK_PARTITION_TYPE_BOOTLOADER; type <= XLINK_PARTITION_TYPE_APP_B; type++)
+    {
+        time_t compile_time = (time_t)inventory.compile_timestamp[type];
+        char time_str[32];
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&compile_time));
+        printf("\n==============================\n");
+        printf("Partition Type: %s\n", partition_str[type]);
+        printf("Partition: 0x%08X, %u bytes\n", inventory.partition_address[type], inventory.partition_size[type]);
+        printf("Firmware Version: v%d.%d.%d\n", (inventory.version[type] >> 16) & 0xFF, (inventory.version[type] >> 8) & 0xFF, inventory.version[type] & 0xFF);
+        printf("Firmware Size: %u bytes\n", inventory.size_bytes[type]);
+        printf("Commit Hash: %x\n", inventory.commit_hash[type]);
+        printf("Compile Timestamp: %s\n", time_str);
+        printf("==============================\n");
+    }
+    printf("Current Base Address: 0x%08X (%s)\n", inventory.current_base_address,
+           inventory.active_partition <= XLINK_PARTITION_TYPE_APP_B ? partition_str[inventory.active_partition] : "UNKNOWN");
+    if (inventory.max_chunk_size == 0)
+    {
+        printf("Upgrade limits: unknown\n");
+        return;
+    }
+    printf("Upgrade limits: %u byte chunks, %u queued, up to %u baud, flags%s%s%s\n",
+           inventory.max_chunk_size, inventory.window, inventory.max_baudrate,
+           (inventory.capabilities & XLINK_UPGRADE_FLAG_PAGE_ERASE) ? " PAGE_ERASE" : "",
+           (inventory.capabilities & XLINK_UPGRADE_FLAG_COMPRESSED) ? " COMPRESSED" : "",
+           (inventory.capabilities & XLINK_UPGRADE_FLAG_RESUME) ? " RESUME" : "");
+}
+
+// expand a -d argument, a pattern that matches nothing is taken as a plain path
+static int add_devices(const char *pattern, vector<string> &device_paths)
+{
+    glob_t matches;
+    int ret = glob(pattern, 0, NULL, &matches);
+    if (ret == GLOB_NOMATCH)
+    {
+        device_paths.push_back(pattern);
+        return 0;
+    }
+    if (ret != 0)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; i++)
+    {
+        device_paths.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return 0;
+}
+
+// Every device gets its own xlink context and a state machine that is driven
+// from one epoll loop, by serial data and by a periodic tick for the timeouts.
+// A single -d runs the same loop as a fleet of one that reports every step.
+// All xlink handlers run on the loop thread, so nothing is locked.
+#define FLEET_TICK_MS 20
+#define FLEET_PROGRESS_MS 250
+#define FLEET_DEFAULT_JOBS 8
+
+struct upgrade_options
+{
+    size_t window = 1;
+    size_t jobs = FLEET_DEFAULT_JOBS; // devices upgraded at the same time
+    bool sparse = false;
+    bool differential = false;
+    bool compressed = false;
+    bool show_only = false;
+    bool verbose = false;                         // report every step instead of the fleet table
+    uint32_t max_baudrate = SERIAL_LINE_BAUDRATE; // highest rate negotiated before the transfer
+};
+
+// images of both slots, prepared once before the first device starts
+struct upgrade_images
+{
+    vector<uint8_t> app[2];            // info page and image of APP_A, APP_B
+    vector<uint8_t> app_compressed[2]; // the same LZSS compressed, with -z
+    vector<uint8_t> boot_from[2];      // BOOTFROM selecting APP_A, APP_B
+};
+
+class upgrade_device
 {
 public:
-    upgrade_partition(xlink_partition_type_t type, xlink_context_p context, int fd)
-        : ctx(context), partition_type(type)
+    upgrade_device(const string &device_path, const upgrade_options &upgrade_opts, const upgrade_images &upgrade_imgs)
+        : path(device_path), options(upgrade_opts), images(upgrade_imgs)
+    {
+        memset(&inventory, 0, sizeof(inventory));
+    }
+
+    ~upgrade_device()
     {
-        switch (partition_type)
+        if (ctx != NULL)
         {
-        case XLINK_PARTITION_TYPE_BOOTLOADER:
-            start_address = PARTITION_ADDRESS_BOOTLOADER;
-            size_bytes = PARTITION_SIZE_BOOTLOADER;
-            partition_name = "BOOTLOADER";
-            break;
-        case XLINK_PARTITION_TYPE_APP_A:
-            start_address = PARTITION_ADDRESS_APP_A_INFO;
-            size_bytes = PARTITION_SIZE_APP_A + PARTITION_SIZE_APP_A_INFO;
-            partition_name = "APP_A";
-            break;
-        case XLINK_PARTITION_TYPE_APP_B:
-            start_address = PARTITION_ADDRESS_APP_B_INFO;
-            size_bytes = PARTITION_SIZE_APP_B + PARTITION_SIZE_APP_B_INFO;
-            partition_name = "APP_B";
-            break;
-        default:
-            start_address = 0;
-            size_bytes = 0;
-            printf("Unknown partition type: %u\n", partition_type);
+            xlink_context_delete(ctx);
+        }
+    }
+
+    int open_device(int epoll_fd)
+    {
+        begin = chrono::steady_clock::now();
+        fd = open(path.c_str(), O_RDWR | O_NOCTTY);
+        if (fd < 0)
+        {
+            fail("open failed");
+            return -1;
+        }
+        serial_set_param(fd, B115200); // keep in sync with SERIAL_LINE_BAUDRATE
+        ctx = xlink_context_create(&host_port, (void *)(size_t)fd);
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = this;
+        if (ctx == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_DEVICE_INVENTORY, device_inventory_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_INFO, firmware_info_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_PAGE_DIGESTS, page_digests_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_SESSION_PROGRESS, session_progress_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE_RESPONSE, start_response_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, chunk_response_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE_RESPONSE, finalize_response_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_SET_BAUDRATE_RESPONSE, baudrate_cb, this) == NULL ||
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_BAUDRATE_CONFIRMED, baudrate_cb, this) == NULL ||
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            fail("xlink setup failed");
+            return -1;
+        }
+        expect_response(DEVICE_INVENTORY, INVENTORY_TIMEOUT_MS);
+        if (xlink_upgrade_get_device_inventory_send(ctx, 0) != 0)
+        {
+            fail("send failed");
+            return -1;
+        }
+        return 0;
+    }
+
+    void close_device(int epoll_fd)
+    {
+        if (fd >= 0)
+        {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    void on_readable()
+    {
+        uint8_t rx_buffer[256];
+        ssize_t read_bytes = read(fd, rx_buffer, sizeof(rx_buffer));
+        if (read_bytes > 0)
+        {
+            xlink_process_rx_buffer(ctx, rx_buffer, (size_t)read_bytes);
+        }
+        else if (read_bytes == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+            fail("read failed");
+        }
+    }
+
+    void on_tick(chrono::steady_clock::time_point now)
+    {
+        if (state == DEVICE_CHUNKS)
+        {
+            pump(now);
+        }
+        else if (!finished() && now > deadline)
+        {
+            if (state == DEVICE_INVENTORY)
+            {
+                // a device predating GetDeviceInventory, ask for the partitions one by one
+                report("Device inventory not answered, querying the partitions one by one\n");
+                info_begin = now;
+                request_info(XLINK_PARTITION_TYPE_BOOTLOADER);
+                return;
+            }
+            if (state == DEVICE_DIGESTS || state == DEVICE_SESSION)
+            {
+                report(state == DEVICE_DIGESTS ? "Page digests unavailable, falling back to a full upgrade\n"
+                                               : "Session progress unavailable, starting over\n");
+                resuming = false;
+                digests_valid = false;
+                begin_stage();
+                return;
+            }
+            if (state == DEVICE_BAUD)
+            {
+                report("Device does not support baudrate switching\n");
+                report("Staying at %u baud\n", baudrate);
+                begin_transfer(); // no answer, a device without baudrate switching
+                return;
+            }
+            if (state == DEVICE_BAUD_CONFIRM && confirm_attempts < BAUDRATE_CONFIRM_ATTEMPTS)
+            {
+                send_confirm();
+                return;
+            }
+            if (state == DEVICE_BAUD_CONFIRM)
+            {
+                report("%u baud not confirmed, trying a lower rate\n", baudrate_candidates[baud_index]);
+                // let the device time out as well before anything is sent at the default rate
+                serial_set_param(fd, baudrate_speed(SERIAL_LINE_BAUDRATE));
+                expect_response(DEVICE_BAUD_SETTLE, BAUDRATE_CONFIRM_TIMEOUT_MS);
+                return;
+            }
+            if (state == DEVICE_BAUD_SETTLE)
+            {
+                tcflush(fd, TCIFLUSH);
+                baud_index++;
+                propose_baudrate();
+                return;
+            }
+            fail("timeout waiting for the device");
+        }
+    }
+
+    bool started() const { return state != DEVICE_WAITING; }
+    bool finished() const { return state == DEVICE_DONE || state == DEVICE_FAILED; }
+    bool failed() const { return state == DEVICE_FAILED; }
+    bool is_open() const { return fd >= 0; }
+    size_t acked_bytes() const { return bytes_acked; }
+    size_t queued_bytes() const { return bytes_total; }
+
+    void print_result() const
+    {
+        if (options.verbose)
+        {
+            if (state == DEVICE_FAILED)
+            {
+                printf("%s: %s\n", options.show_only ? "Failed to get device inventory" : "Firmware upgrade failed", error.c_str());
+            }
             return;
         }
-        int ret = lseek(fd, start_address - PARTITION_ADDRESS_BOOTLOADER, SEEK_SET);
-        if (ret < 0)
+        const char *slot = target == XLINK_PARTITION_TYPE_APP_A ? "APP_A" : target == XLINK_PARTITION_TYPE_APP_B ? "APP_B"
+                                                                                                                  : "-";
+        string note = error;
+        if (options.show_only && state == DEVICE_DONE)
+        {
+            uint32_t active_version = inventory.version[target == XLINK_PARTITION_TYPE_APP_A ? XLINK_PARTITION_TYPE_APP_B : XLINK_PARTITION_TYPE_APP_A];
+            uint32_t boot_version = inventory.version[XLINK_PARTITION_TYPE_BOOTLOADER];
+            char version[64];
+            snprintf(version, sizeof(version), "active v%u.%u.%u, boot v%u.%u.%u",
+                     (active_version >> 16) & 0xFF, (active_version >> 8) & 0xFF, active_version & 0xFF,
+                     (boot_version >> 16) & 0xFF, (boot_version >> 8) & 0xFF, boot_version & 0xFF);
+            note = version;
+        }
+        else if (resumed && state == DEVICE_DONE)
+        {
+            note = "resumed";
+        }
+        printf("%-24s %-6s %-6s %7u %8zu %6u %8.2f  %s\n",
+               path.c_str(),
+               state == DEVICE_DONE ? "ok" : state == DEVICE_FAILED ? "FAILED"
+                                                                    : "-",
+               slot,
+               baudrate,
+               bytes_acked,
+               retransmits,
+               chrono::duration<double>(end - begin).count(),
+               note.c_str());
+    }
+
+private:
+    enum device_state
+    {
+        DEVICE_WAITING,
+        DEVICE_INVENTORY,
+        DEVICE_INFO,
+        DEVICE_BAUD,
+        DEVICE_BAUD_CONFIRM,
+        DEVICE_BAUD_SETTLE,
+        DEVICE_SESSION,
+        DEVICE_DIGESTS,
+        DEVICE_START,
+        DEVICE_CHUNKS,
+        DEVICE_FINALIZE,
+        DEVICE_DONE,
+        DEVICE_FAILED,
+    };
+
+    const int response_timeout_ms = 5000;
+    const int session_timeout_ms = 200;
+    const int chunk_timeout_ms = 1000;
+    const unsigned chunk_max_attempts = 5;
+
+    string path;
+    const upgrade_options &options;
+    const upgrade_images &images;
+    int fd = -1;
+    xlink_context_p ctx = NULL;
+    device_state state = DEVICE_WAITING;
+    chrono::steady_clock::time_point deadline;
+    chrono::steady_clock::time_point requested_at; // when the request being waited for was sent
+    chrono::steady_clock::time_point begin;
+    chrono::steady_clock::time_point end;
+    string error;
+    xlink_upgrade_device_inventory_t inventory; // limits stay 0 when the device only answered GetFirmwareInfo
+    uint8_t info_partition = XLINK_PARTITION_TYPE_BOOTLOADER;
+    chrono::steady_clock::time_point info_begin;
+    xlink_partition_type_t target = XLINK_PARTITION_TYPE_BOOTLOADER;
+    uint32_t baudrate = SERIAL_LINE_BAUDRATE;
+    size_t baud_index = 0; // next entry of baudrate_candidates to propose
+    int confirm_attempts = 0;
+    chrono::steady_clock::time_point baud_begin;
+    bool boot_from_stage = false; // the app slot is done, BOOTFROM is being written
+
+    // transfer of the current stage
+    uint32_t start_address = 0;
+    const vector<uint8_t> *image = nullptr;  // what the device must read back
+    const vector<uint8_t> *stream = nullptr; // what is sent, compressed or not
+    xlink_upgrade_flag_t flags = XLINK_UPGRADE_FLAG_NONE;
+    size_t chunk_size = XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN;
+    set<uint32_t> chunk_pending;
+    map<uint32_t, chrono::steady_clock::time_point> chunk_in_flight;
+    map<uint32_t, unsigned> chunk_attempts;
+    set<uint32_t> chunk_gap;
+    size_t chunk_count = 0;
+    size_t chunk_acked = 0;
+    size_t chunk_skipped = 0;
+    size_t bytes_acked = 0;
+    size_t bytes_total = 0;
+    size_t stage_bytes = 0; // part of bytes_total queued by the current stage
+    unsigned retransmits = 0;
+    unsigned stage_retransmits = 0; // retransmits before the current stage
+    chrono::steady_clock::time_point stage_begin;
+    latency_stats chunk_latency;
+
+    // -D: page digests are fetched in batches before the app slot is started
+    vector<uint32_t> digests;
+    size_t digest_next = 0;
+    uint8_t digest_count = 0; // pages asked for by the request in flight
+    bool digests_valid = false;
+    set<uint32_t> changed_pages;
+    chrono::steady_clock::time_point digest_begin;
+
+    // an interrupted session of this image: only its written pages are digested
+    xlink_upgrade_session_progress_t progress;
+    bool resuming = false;
+    bool resumed = false;
+
+    size_t slot_index() const
+    {
+        return target == XLINK_PARTITION_TYPE_APP_A ? 0 : 1;
+    }
+
+    uint32_t slot_address() const
+    {
+        return target == XLINK_PARTITION_TYPE_APP_A ? PARTITION_ADDRESS_APP_A_INFO : PARTITION_ADDRESS_APP_B_INFO;
+    }
+
+    const char *stage_name() const
+    {
+        return boot_from_stage ? "BOOTFROM" : target == XLINK_PARTITION_TYPE_APP_A ? "APP_A"
+                                                                                   : "APP_B";
+    }
+
+    static long long elapsed_us(chrono::steady_clock::time_point since)
+    {
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - since).count();
+    }
+
+    // progress of a fleet of one, a bigger fleet only shows the summary line and table
+    void report(const char *format, ...) const __attribute__((format(printf, 2, 3)))
+    {
+        if (!options.verbose)
         {
-            printf("lseek to partition %s failed\n", partition_name.c_str());
             return;
         }
-        firmware_data.resize(size_bytes);
-        ssize_t read_bytes = read(fd, firmware_data.data(), size_bytes);
-        if (read_bytes != (ssize_t)size_bytes)
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        fflush(stdout);
+    }
+
+    void fail(const string &why)
+    {
+        if (finished())
         {
-            printf("read partition %s failed\n", partition_name.c_str());
-            firmware_data.clear();
             return;
         }
+        if (state == DEVICE_CHUNKS)
+        {
+            report("\n"); // end the progress line
+        }
+        error = why;
+        state = DEVICE_FAILED;
+        end = chrono::steady_clock::now();
+        if (fd >= 0 && ctx != NULL && baudrate != SERIAL_LINE_BAUDRATE)
+        {
+            // leave the device where the next run looks for it, it falls back by itself if this is lost
+            xlink_upgrade_set_baudrate_send(ctx, SERIAL_LINE_BAUDRATE, BAUDRATE_CONFIRM_TIMEOUT_MS);
+            tcdrain(fd);
+        }
+    }
+
+    void finish()
+    {
+        state = DEVICE_DONE;
+        end = chrono::steady_clock::now();
+    }
+
+    void expect_response(device_state next, int timeout_ms = 0)
+    {
+        state = next;
+        requested_at = chrono::steady_clock::now();
+        deadline = requested_at + chrono::milliseconds(timeout_ms > 0 ? timeout_ms : response_timeout_ms);
+    }
+
+    void request_info(uint8_t partition)
+    {
+        info_partition = partition;
+        expect_response(DEVICE_INFO, INVENTORY_TIMEOUT_MS);
+        if (xlink_upgrade_get_firmware_info_send(ctx, partition) != 0)
+        {
+            fail("send failed");
+        }
     }
 
-    upgrade_partition(uint32_t _start_address, uint32_t _size_bytes, string _partition_name, xlink_context_p context, const uint8_t *data, size_t data_len)
-        : start_address(_start_address), size_bytes(_size_bytes), partition_name(_partition_name), ctx(context)
+    // the inventory is complete, the slot that is not active is the target
+    void on_inventory()
     {
-        if (data_len > size_bytes)
+        target = inventory.active_partition == XLINK_PARTITION_TYPE_APP_A ? XLINK_PARTITION_TYPE_APP_B : XLINK_PARTITION_TYPE_APP_A;
+        if (options.verbose)
+        {
+            print_device_inventory(inventory);
+            printf("Current active partition: %s, will upgrade %s\n",
+                   target == XLINK_PARTITION_TYPE_APP_A ? "APP_B" : "APP_A", stage_name());
+        }
+        if (options.show_only)
         {
-            printf("Invalid data length for partition %s: %zu\n", partition_name.c_str(), data_len);
+            finish();
             return;
         }
-        firmware_data.resize(size_bytes);
-        memset(firmware_data.data(), 0xFF, size_bytes);
-        memcpy(firmware_data.data(), data, data_len);
+        baud_begin = chrono::steady_clock::now();
+        propose_baudrate();
     }
 
-    int perform_upgrade()
+    // propose the fastest candidate not tried yet, or go on at the current rate
+    void propose_baudrate()
     {
-        printf("Starting firmware upgrade for partition %s...\n", partition_name.c_str());
-        int ret = send_start_upgrade();
-        if (ret != 0)
+        const size_t count = sizeof(baudrate_candidates) / sizeof(baudrate_candidates[0]);
+        bool tried = baud_index > 0;
+        while (baud_index < count &&
+               (baudrate_candidates[baud_index] > options.max_baudrate ||
+                (inventory.max_baudrate != 0 && baudrate_candidates[baud_index] > inventory.max_baudrate)))
         {
-            return -1;
+            baud_index++;
         }
-        size_t offset = 0;
-        while (offset * chunk_size < (size_t)size_bytes)
+        if (baud_index == count)
         {
-            size_t chunk_len = ((size_t)size_bytes - offset * chunk_size) > chunk_size ? chunk_size : ((size_t)size_bytes - offset * chunk_size);
-            ret = send_firmware_chunk((uint32_t)offset, &firmware_data[offset * chunk_size], (uint8_t)chunk_len);
-            if (ret != 0)
+            if (tried)
             {
-                return -1;
+                report("Staying at %u baud\n", baudrate);
             }
-            printf("\rProgress: %.2f%%", (float)(offset * chunk_size + chunk_len) * 100.0f / (float)size_bytes);
-            fflush(stdout);
-            offset++;
+            begin_transfer();
+            return;
         }
-        printf("\n");
-        ret = send_finalize_upgrade(crc16);
-        if (ret != 0)
+        expect_response(DEVICE_BAUD, BAUDRATE_RESPONSE_TIMEOUT_MS);
+        if (xlink_upgrade_set_baudrate_send(ctx, baudrate_candidates[baud_index], BAUDRATE_CONFIRM_TIMEOUT_MS) != 0)
         {
-            return -1;
+            fail("send failed");
         }
-        return 0;
     }
 
-private:
-    uint32_t start_address;
-    uint32_t size_bytes;
-    string partition_name;
-    xlink_context_p ctx;
-    xlink_partition_type_t partition_type;
-    vector<uint8_t> firmware_data;
-
-    const size_t chunk_size = 200;
-    uint16_t crc16 = 0;
-
-    int send_start_upgrade()
-    {
-        crc16 = XLINK_INIT_CRC16;
-        int ret = -1;
-        xlink_msg_handler_t handler_handle = xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE_RESPONSE, [](uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data) -> int
-                                                                        {
-            (void)comp_id;
-            (void)msg_id;
-            if (payload_len != sizeof(xlink_upgrade_start_firmware_upgrade_response_t))
+    void send_confirm()
+    {
+        confirm_attempts++;
+        expect_response(DEVICE_BAUD_CONFIRM, BAUDRATE_CONFIRM_WAIT_MS);
+        if (xlink_upgrade_confirm_baudrate_send(ctx, baudrate_candidates[baud_index]) != 0)
+        {
+            fail("send failed");
+        }
+    }
+
+    // the device info is known and the line rate settled, fetch digests or start the app slot
+    void begin_transfer()
+    {
+        if (options.differential && !options.compressed)
+        {
+            digests.assign(size_to_pages(images.app[slot_index()].size()), 0);
+            digest_next = 0;
+            digest_begin = chrono::steady_clock::now();
+            request_digests();
+        }
+        else if (!options.compressed)
+        {
+            expect_response(DEVICE_SESSION, session_timeout_ms);
+            if (xlink_upgrade_get_session_progress_send(ctx, image_session_id(images.app[slot_index()], slot_address())) != 0)
             {
-                printf("Invalid start firmware upgrade response length: %u\n", payload_len);
-                return -1;
+                fail("send failed");
             }
-            const xlink_upgrade_start_firmware_upgrade_response_t *response = (const xlink_upgrade_start_firmware_upgrade_response_t *)payload;
-            if (!response->accepted)
+        }
+        else
+        {
+            begin_stage();
+        }
+    }
+
+    void request_digests()
+    {
+        const size_t max_pages = sizeof(((xlink_upgrade_page_digests_t *)0)->digests) / sizeof(uint32_t);
+        digest_count = (uint8_t)min(max_pages, digests.size() - digest_next);
+        expect_response(DEVICE_DIGESTS);
+        if (xlink_upgrade_get_page_digests_send(ctx, slot_address() + (uint32_t)(digest_next * PAGE_SIZE), digest_count) != 0)
+        {
+            fail("send failed");
+        }
+    }
+
+    void begin_stage()
+    {
+        const vector<uint8_t> &data = boot_from_stage ? images.boot_from[slot_index()] : images.app[slot_index()];
+        start_address = boot_from_stage ? (uint32_t)PARTITION_ADDRESS_BOOTFROM : slot_address();
+        image = &data;
+        stream = &data;
+        flags = XLINK_UPGRADE_FLAG_NONE;
+        chunk_size = XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN;
+        report("Starting firmware upgrade for partition %s...\n", stage_name());
+        if (!boot_from_stage && options.compressed)
+        {
+            stream = &images.app_compressed[slot_index()];
+            flags |= XLINK_UPGRADE_FLAG_COMPRESSED;
+            report("Compressed %zu bytes to %zu bytes (%.1f%%)\n",
+                   image->size(), stream->size(), image->size() > 0 ? (double)stream->size() * 100.0 / (double)image->size() : 0);
+        }
+        else if (!boot_from_stage && digests_valid)
+        {
+            flags |= XLINK_UPGRADE_FLAG_PAGE_ERASE;
+            flags |= resuming ? XLINK_UPGRADE_FLAG_RESUME : XLINK_UPGRADE_FLAG_NONE;
+            chunk_size = page_chunk_size();
+        }
+
+        chunk_pending.clear();
+        chunk_in_flight.clear();
+        chunk_attempts.clear();
+        chunk_gap.clear();
+        chunk_count = 0;
+        chunk_acked = 0;
+        chunk_skipped = 0;
+        stage_bytes = 0;
+        for (size_t pos = 0; pos < stream->size(); pos += chunk_size)
+        {
+            bool page_start = pos % PAGE_SIZE == 0;
+            if ((flags & XLINK_UPGRADE_FLAG_PAGE_ERASE) && !changed_pages.count((uint32_t)(pos / PAGE_SIZE)))
             {
-                printf("Firmware upgrade request was rejected by the device\n");
-                return -1;
+                chunk_skipped++;
+                continue;
+            }
+            if (options.sparse && !(flags & XLINK_UPGRADE_FLAG_COMPRESSED) &&
+                !((flags & XLINK_UPGRADE_FLAG_PAGE_ERASE) && page_start) &&
+                chunk_is_erased(pos, min(chunk_size, stream->size() - pos)))
+            {
+                chunk_skipped++;
+                continue;
             }
-            printf("Firmware upgrade request accepted by the device\n");
-            *(int *)user_data = 0;
-            return 0; }, &ret);
-        int wait_time = 500; // 500 * 10ms = 5s
-        if (xlink_upgrade_start_firmware_upgrade_send(ctx, start_address, size_bytes, chunk_size) < 0)
+            chunk_pending.insert((uint32_t)(pos / chunk_size));
+            stage_bytes += min(chunk_size, stream->size() - pos);
+            chunk_count++;
+        }
+        bytes_total += stage_bytes;
+        stage_retransmits = retransmits;
+        chunk_latency = latency_stats();
+
+        expect_response(DEVICE_START);
+        // BOOTFROM is a single page that is simply rewritten, so it is not journaled
+        if (xlink_upgrade_start_firmware_upgrade_send(ctx, start_address, (uint32_t)image->size(), (uint32_t)chunk_size, flags,
+                                                      boot_from_stage ? 0 : image_session_id(*image, start_address)) < 0)
         {
-            printf("Failed to start firmware upgrade for partition %s\n", partition_name.c_str());
-            goto __exit;
+            fail("send failed");
         }
-        while (ret != 0 && wait_time-- > 0)
+    }
+
+    // erased chunks need not be sent: the device erases a page on its first chunk and
+    // erases untouched pages at finalize; with PAGE_ERASE the first chunk of a page is always sent
+    bool chunk_is_erased(size_t pos, size_t len) const
+    {
+        for (size_t i = pos; i < pos + len; i++)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if ((*image)[i] != 0xFF)
+            {
+                return false;
+            }
         }
-        if (ret != 0)
+        return true;
+    }
+
+    bool chunk_behind_gap(uint32_t offset) const
+    {
+        return (!chunk_in_flight.empty() && chunk_in_flight.begin()->first < offset) ||
+               (!chunk_pending.empty() && *chunk_pending.begin() < offset);
+    }
+
+    void print_goodput() const
+    {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - stage_begin).count();
+        double goodput = seconds > 0 ? (double)stage_bytes / seconds : 0;
+        double effective = seconds > 0 ? (double)image->size() / seconds : 0;
+        double line_rate = (double)baudrate / SERIAL_BITS_PER_BYTE;
+        printf("Sent %zu bytes for a %zu byte image in %zu chunks (%u retransmitted, window %zu) in %.2f s\n",
+               stage_bytes, image->size(), chunk_count, retransmits - stage_retransmits, options.window, seconds);
+        printf("Goodput: %.0f B/s, %.1f%% of %u baud line rate, %.0f image B/s\n",
+               goodput, goodput * 100.0 / line_rate, baudrate, effective);
+    }
+
+    // expire lost chunks, keep the window full and finalize once everything is acked
+    void pump(chrono::steady_clock::time_point now)
+    {
+        for (auto it = chunk_in_flight.begin(); it != chunk_in_flight.end();)
         {
-            printf("Timeout waiting for start firmware upgrade response for partition %s\n", partition_name.c_str());
-            goto __exit;
+            if (now - it->second > chrono::milliseconds(chunk_timeout_ms))
+            {
+                chunk_pending.insert(it->first);
+                it = chunk_in_flight.erase(it);
+                continue;
+            }
+            ++it;
         }
-    __exit:
-        xlink_unregister_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE_RESPONSE, handler_handle, &ret);
-        return ret;
+        while (chunk_in_flight.size() < options.window && !chunk_pending.empty())
+        {
+            uint32_t offset = *chunk_pending.begin();
+            chunk_pending.erase(chunk_pending.begin());
+            if (chunk_gap.erase(offset) > 0 || ++chunk_attempts[offset] > 1)
+            {
+                retransmits++;
+            }
+            if (chunk_attempts[offset] > chunk_max_attempts)
+            {
+                fail("chunk " + to_string(offset) + " failed after " + to_string(chunk_max_attempts) + " attempts");
+                return;
+            }
+            chunk_in_flight[offset] = now;
+            size_t pos = (size_t)offset * chunk_size;
+            size_t chunk_len = min(chunk_size, stream->size() - pos);
+            if (xlink_upgrade_firmware_chunk_send(ctx, offset, &(*stream)[pos], (uint8_t)chunk_len) != 0)
+            {
+                fail("send failed");
+                return;
+            }
+        }
+        if (chunk_acked == chunk_count)
+        {
+            if (options.verbose)
+            {
+                printf("\rProgress: 100.00%%\n");
+                if (chunk_skipped > 0)
+                {
+                    printf("Skipped %zu unchanged or erased chunks\n", chunk_skipped);
+                }
+                print_goodput();
+                chunk_latency.print("Chunk");
+            }
+            expect_response(DEVICE_FINALIZE);
+            if (xlink_upgrade_finalize_firmware_upgrade_send(ctx, crc32_calculate(image->data(), image->size(), 0)) != 0)
+            {
+                fail("send failed");
+            }
+        }
+    }
+
+    static int device_inventory_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+    {
+        (void)comp_id;
+        (void)msg_id;
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (self->state != DEVICE_INVENTORY || payload_len != sizeof(xlink_upgrade_device_inventory_t))
+        {
+            return -1;
+        }
+        memcpy(&self->inventory, payload, sizeof(self->inventory));
+        self->report("Device inventory round trip: %lld us\n", elapsed_us(self->requested_at));
+        self->on_inventory();
+        return 0;
+    }
+
+    // devices predating GetDeviceInventory: one GetFirmwareInfo per partition, the limits stay 0 for unknown
+    static int firmware_info_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+    {
+        (void)comp_id;
+        (void)msg_id;
+        const uint32_t partition_address[3] = {PARTITION_ADDRESS_BOOTLOADER, PARTITION_ADDRESS_APP_A_INFO, PARTITION_ADDRESS_APP_B_INFO};
+        const uint32_t partition_size[3] = {PARTITION_SIZE_BOOTLOADER, PARTITION_SIZE_APP_A_INFO + PARTITION_SIZE_APP_A, PARTITION_SIZE_APP_B_INFO + PARTITION_SIZE_APP_B};
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (self->state != DEVICE_INFO || payload_len != sizeof(xlink_upgrade_firmware_info_t))
+        {
+            return -1;
+        }
+        const xlink_upgrade_firmware_info_t *info = (const xlink_upgrade_firmware_info_t *)payload;
+        uint8_t type = self->info_partition;
+        if (info->partition_type != type)
+        {
+            return 0; // reply to an earlier request
+        }
+        self->inventory.partition_address[type] = partition_address[type];
+        self->inventory.partition_size[type] = partition_size[type];
+        self->inventory.version[type] = info->version;
+        self->inventory.size_bytes[type] = info->size_bytes;
+        self->inventory.commit_hash[type] = info->commit_hash;
+        self->inventory.compile_timestamp[type] = info->compile_timestamp;
+        self->inventory.current_base_address = info->current_base_address;
+        if (type < XLINK_PARTITION_TYPE_APP_B)
+        {
+            self->request_info(type + 1);
+            return 0;
+        }
+        self->inventory.active_partition = info->current_base_address == PARTITION_ADDRESS_APP_A   ? XLINK_PARTITION_TYPE_APP_A
+                                           : info->current_base_address == PARTITION_ADDRESS_APP_B ? XLINK_PARTITION_TYPE_APP_B
+                                                                                                   : XLINK_PARTITION_TYPE_BOOTLOADER;
+        self->report("Firmware info of 3 partitions: %lld us\n", elapsed_us(self->info_begin));
+        self->on_inventory();
+        return 0;
     }
 
-    int send_firmware_chunk(uint32_t offset, const uint8_t *data, uint8_t data_len)
+    static int baudrate_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
     {
-        int ret = -1;
-        xlink_msg_handler_t handler_handle = xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, [](uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data) -> int
-                                                                        {
-            (void)comp_id;
-            (void)msg_id;
-            if (payload_len != sizeof(xlink_upgrade_firmware_chunk_response_t))
+        (void)comp_id;
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (msg_id == XLINK_UPGRADE_MSG_ID_SET_BAUDRATE_RESPONSE)
+        {
+            const xlink_upgrade_set_baudrate_response_t *response = (const xlink_upgrade_set_baudrate_response_t *)payload;
+            if (self->state != DEVICE_BAUD || payload_len != sizeof(*response) ||
+                response->baudrate != baudrate_candidates[self->baud_index])
             {
-                printf("Invalid firmware chunk response length: %u\n", payload_len);
                 return -1;
             }
-            const xlink_upgrade_firmware_chunk_response_t *response = (const xlink_upgrade_firmware_chunk_response_t *)payload;
             if (!response->accepted)
             {
-                printf("Firmware chunk at offset %u was rejected by the device\n", response->offset);
-                return -1;
+                self->report("%u baud not confirmed, trying a lower rate\n", response->baudrate);
+                self->baud_index++;
+                self->propose_baudrate();
+                return 0;
+            }
+            // the device switches once its response is out, switch after it
+            tcdrain(self->fd);
+            serial_set_param(self->fd, baudrate_speed(response->baudrate));
+            tcflush(self->fd, TCIFLUSH);
+            self->confirm_attempts = 0;
+            self->send_confirm();
+            return 0;
+        }
+        const xlink_upgrade_baudrate_confirmed_t *response = (const xlink_upgrade_baudrate_confirmed_t *)payload;
+        if (self->state != DEVICE_BAUD_CONFIRM || payload_len != sizeof(*response) ||
+            response->baudrate != baudrate_candidates[self->baud_index])
+        {
+            return -1;
+        }
+        self->baudrate = response->baudrate;
+        self->report("Line switched to %u baud (%lld ms)\n", self->baudrate, elapsed_us(self->baud_begin) / 1000);
+        self->begin_transfer();
+        return 0;
+    }
+
+    static int page_digests_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+    {
+        (void)comp_id;
+        (void)msg_id;
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (self->state != DEVICE_DIGESTS || payload_len != sizeof(xlink_upgrade_page_digests_t))
+        {
+            return -1;
+        }
+        const xlink_upgrade_page_digests_t *response = (const xlink_upgrade_page_digests_t *)payload;
+        if (response->start_address != self->slot_address() + (uint32_t)(self->digest_next * PAGE_SIZE))
+        {
+            return 0; // reply to an earlier request
+        }
+        if (response->page_count != self->digest_count)
+        {
+            self->report("Page digests unavailable, falling back to a full upgrade\n");
+            self->resuming = false;
+            self->begin_stage();
+            return 0;
+        }
+        memcpy(&self->digests[self->digest_next], response->digests, response->page_count * sizeof(uint32_t));
+        self->digest_next += response->page_count;
+        if (self->digest_next < self->digests.size())
+        {
+            self->request_digests();
+            return 0;
+        }
+
+        const vector<uint8_t> &data = self->images.app[self->slot_index()];
+        size_t page_count = size_to_pages(data.size());
+        self->changed_pages.clear();
+        if (self->resuming)
+        {
+            self->changed_pages = session_pages_to_send(self->progress, data, self->digests);
+            self->report("Resuming an interrupted session: %zu of %zu pages left to send\n", self->changed_pages.size(), page_count);
+        }
+        else
+        {
+            for (size_t page = 0; page < self->digests.size(); page++)
+            {
+                if (image_page_crc(data, page) != self->digests[page])
+                {
+                    self->changed_pages.insert((uint32_t)page);
+                }
             }
-            *(int *)user_data = 0;
-            return 0; }, &ret);
-        int wait_time = 500; // 500 * 10ms = 5s
-        if (xlink_upgrade_firmware_chunk_send(ctx, offset, data, data_len) != 0)
+            self->report("%zu of %zu pages differ on the device (digests in %lld ms)\n",
+                         self->changed_pages.size(), page_count, elapsed_us(self->digest_begin) / 1000);
+        }
+        self->digests_valid = true;
+        self->begin_stage();
+        return 0;
+    }
+
+    static int session_progress_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+    {
+        (void)comp_id;
+        (void)msg_id;
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (self->state != DEVICE_SESSION || payload_len != sizeof(xlink_upgrade_session_progress_t))
         {
-            printf("Failed to send firmware chunk at offset %u for partition %s\n", offset, partition_name.c_str());
-            goto __exit;
+            return -1;
         }
-        while (ret != 0 && wait_time-- > 0)
+        memcpy(&self->progress, payload, sizeof(self->progress));
+        if (!session_resumable(self->progress, self->images.app[self->slot_index()], self->slot_address()))
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            self->begin_stage();
+            return 0;
         }
-        if (ret != 0)
+        // digest the pages up to the last one written, everything after it is sent anyway
+        size_t digest_pages = 0;
+        for (size_t page = 0; page < self->progress.page_count; page++)
         {
-            printf("Timeout waiting for firmware chunk response at offset %u for partition %s\n", offset, partition_name.c_str());
-            goto __exit;
+            digest_pages = session_page_written(self->progress, page) ? page + 1 : digest_pages;
         }
-    __exit:
-        xlink_unregister_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, handler_handle, &ret);
-        if (ret == 0)
+        self->resuming = true;
+        self->digests.assign(digest_pages, 0);
+        self->digest_next = 0;
+        self->request_digests();
+        return 0;
+    }
+
+    static int start_response_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+    {
+        (void)comp_id;
+        (void)msg_id;
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (self->state != DEVICE_START || payload_len != sizeof(xlink_upgrade_start_firmware_upgrade_response_t))
+        {
+            return -1;
+        }
+        if (!((const xlink_upgrade_start_firmware_upgrade_response_t *)payload)->accepted &&
+            (self->flags & XLINK_UPGRADE_FLAG_RESUME))
         {
-            crc16 = xlink_crc16_with_init(data, data_len, crc16);
+            // the journal did not match after all, start the slot over
+            self->report("Session can not be resumed, starting over\n");
+            self->bytes_total -= self->stage_bytes;
+            self->resuming = false;
+            self->digests_valid = false;
+            self->begin_stage();
+            return 0;
         }
-        return ret;
+        if (!((const xlink_upgrade_start_firmware_upgrade_response_t *)payload)->accepted)
+        {
+            self->fail("start rejected");
+            return -1;
+        }
+        self->report("Firmware upgrade request accepted by the device (%lld us)\n", elapsed_us(self->requested_at));
+        self->resumed = (self->flags & XLINK_UPGRADE_FLAG_RESUME) != 0 || self->resumed;
+        self->state = DEVICE_CHUNKS;
+        self->stage_begin = chrono::steady_clock::now();
+        self->pump(self->stage_begin);
+        return 0;
     }
 
-    int send_finalize_upgrade(uint32_t expected_crc32)
+    static int chunk_response_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
     {
-        int ret = -1;
-        xlink_msg_handler_t handler_handle = xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE_RESPONSE, [](uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data) -> int
-                                                                        {
-            (void)comp_id;
-            (void)msg_id;
-            if (payload_len != sizeof(xlink_upgrade_finalize_firmware_upgrade_response_t))
+        (void)comp_id;
+        (void)msg_id;
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (self->state != DEVICE_CHUNKS || payload_len != sizeof(xlink_upgrade_firmware_chunk_response_t))
+        {
+            return -1;
+        }
+        const xlink_upgrade_firmware_chunk_response_t *response = (const xlink_upgrade_firmware_chunk_response_t *)payload;
+        auto it = self->chunk_in_flight.find(response->offset);
+        if (it == self->chunk_in_flight.end())
+        {
+            return 0; // late response for a chunk that was already retransmitted
+        }
+        auto sent_at = it->second;
+        self->chunk_in_flight.erase(it);
+        self->chunk_latency.add(elapsed_us(sent_at));
+        if (!response->accepted && (self->flags & XLINK_UPGRADE_FLAG_COMPRESSED) && self->chunk_behind_gap(response->offset))
+        {
+            // overtook a lost chunk of the in order stream, resend the oldest one first
+            self->chunk_pending.insert(response->offset);
+            self->chunk_gap.insert(response->offset);
+            auto oldest = self->chunk_in_flight.begin();
+            if (oldest != self->chunk_in_flight.end() && oldest->first < response->offset && oldest->second <= sent_at)
             {
-                printf("Invalid finalize firmware upgrade response length: %u\n", payload_len);
-                return -1;
+                self->chunk_pending.insert(oldest->first);
+                self->chunk_in_flight.erase(oldest);
             }
-            const xlink_upgrade_finalize_firmware_upgrade_response_t *response = (const xlink_upgrade_finalize_firmware_upgrade_response_t *)payload;
-            if (!response->success)
+        }
+        else if (!response->accepted)
+        {
+            self->report("\nFirmware chunk at offset %u was rejected by the device\n", response->offset);
+            self->chunk_pending.insert(response->offset);
+        }
+        else
+        {
+            size_t pos = (size_t)response->offset * self->chunk_size;
+            self->bytes_acked += min(self->chunk_size, self->stream->size() - pos);
+            self->chunk_acked++;
+            self->report("\rProgress: %.2f%%", (float)self->chunk_acked * 100.0f / (float)self->chunk_count);
+        }
+        self->pump(chrono::steady_clock::now());
+        return 0;
+    }
+
+    static int finalize_response_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+    {
+        (void)comp_id;
+        (void)msg_id;
+        upgrade_device *self = (upgrade_device *)user_data;
+        if (self->state != DEVICE_FINALIZE || payload_len != sizeof(xlink_upgrade_finalize_firmware_upgrade_response_t))
+        {
+            return -1;
+        }
+        if (!((const xlink_upgrade_finalize_firmware_upgrade_response_t *)payload)->success)
+        {
+            self->fail(self->boot_from_stage ? "BOOTFROM finalize rejected" : "finalize rejected");
+            return -1;
+        }
+        self->report("Firmware upgrade finalized successfully by the device (%lld us)\n", elapsed_us(self->requested_at));
+        if (!self->boot_from_stage)
+        {
+            self->boot_from_stage = true;
+            self->begin_stage();
+            return 0;
+        }
+        self->report("Firmware upgrade completed successfully\n");
+        self->report("Reset the device to boot into the new firmware\n");
+        xlink_upgrade_restart_device_send(self->ctx, true);
+        tcdrain(self->fd);
+        self->finish();
+        return 0;
+    }
+};
+
+static int prepare_images(int firmware_fd, const upgrade_options &options, upgrade_images &images)
+{
+    const xlink_partition_type_t slots[2] = {XLINK_PARTITION_TYPE_APP_A, XLINK_PARTITION_TYPE_APP_B};
+    const uint32_t addresses[2] = {PARTITION_ADDRESS_APP_A_INFO, PARTITION_ADDRESS_APP_B_INFO};
+    const uint32_t sizes[2] = {PARTITION_SIZE_APP_A + PARTITION_SIZE_APP_A_INFO, PARTITION_SIZE_APP_B + PARTITION_SIZE_APP_B_INFO};
+    for (size_t i = 0; i < 2; i++)
+    {
+        if (!read_partition_image(firmware_fd, slots[i], addresses[i], sizes[i], images.app[i]))
+        {
+            printf("read partition %s failed\n", i == 0 ? "APP_A" : "APP_B");
+            return -1;
+        }
+        if (options.compressed)
+        {
+            vector<uint8_t> &compressed = images.app_compressed[i];
+            compressed.resize(images.app[i].size() + images.app[i].size() / 8 + 1);
+            compressed.resize(lzss_encode(images.app[i].data(), images.app[i].size(), compressed.data(), compressed.size()));
+        }
+        BootFromInfo_t boot_from_info = make_boot_from_info(slots[i]);
+        images.boot_from[i].assign(PARTITION_SIZE_BOOTFROM, 0xFF);
+        memcpy(images.boot_from[i].data(), &boot_from_info, sizeof(boot_from_info));
+    }
+    return 0;
+}
+
+static int fleet_upgrade(const vector<string> &device_paths, int firmware_fd, const upgrade_options &options)
+{
+    upgrade_images images;
+    if (!options.show_only && prepare_images(firmware_fd, options, images) != 0)
+    {
+        return -1;
+    }
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+    {
+        printf("epoll_create1 failed\n");
+        return -1;
+    }
+
+    vector<unique_ptr<upgrade_device>> fleet;
+    for (const string &path : device_paths)
+    {
+        fleet.emplace_back(new upgrade_device(path, options, images));
+    }
+    size_t jobs = options.jobs > 0 ? options.jobs : 1;
+    size_t next = 0;
+    size_t active = 0;
+    auto begin = chrono::steady_clock::now();
+    auto progress_at = begin;
+    if (!options.verbose)
+    {
+        printf("Upgrading %zu devices, %zu at a time\n", fleet.size(), jobs);
+    }
+
+    for (;;)
+    {
+        while (active < jobs && next < fleet.size())
+        {
+            upgrade_device *device = fleet[next++].get();
+            if (device->open_device(epoll_fd) == 0)
             {
-                printf("Finalize firmware upgrade was rejected by the device\n");
-                return -1;
+                active++;
+            }
+            else
+            {
+                device->close_device(epoll_fd);
             }
-            printf("Firmware upgrade finalized successfully by the device\n");
-            *(int *)user_data = 0;
-            return 0; }, &ret);
-        int wait_time = 500; // 500 * 10ms = 5s
-        if (xlink_upgrade_finalize_firmware_upgrade_send(ctx, expected_crc32) != 0)
+        }
+        if (active == 0)
         {
-            printf("Failed to finalize firmware upgrade for partition %s\n", partition_name.c_str());
-            goto __exit;
+            break;
         }
-        while (ret != 0 && wait_time-- > 0)
+
+        struct epoll_event events[16];
+        int count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), FLEET_TICK_MS);
+        for (int i = 0; i < count; i++)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ((upgrade_device *)events[i].data.ptr)->on_readable();
+        }
+
+        auto now = chrono::steady_clock::now();
+        size_t done = 0;
+        size_t failed = 0;
+        size_t acked = 0;
+        size_t queued = 0;
+        for (auto &device : fleet)
+        {
+            if (device->is_open())
+            {
+                device->on_tick(now);
+                if (device->finished())
+                {
+                    device->close_device(epoll_fd);
+                    active--;
+                }
+            }
+            done += device->finished() && !device->failed();
+            failed += device->failed();
+            acked += device->acked_bytes();
+            queued += device->queued_bytes();
         }
-        if (ret != 0)
+        if (!options.verbose && now - progress_at >= chrono::milliseconds(FLEET_PROGRESS_MS))
         {
-            printf("Timeout waiting for finalize firmware upgrade response for partition %s\n", partition_name.c_str());
-            goto __exit;
+            progress_at = now;
+            printf("\rFleet: %zu done, %zu failed, %zu active, %zu waiting, %zu of %zu bytes acked",
+                   done, failed, active, fleet.size() - next, acked, queued);
+            fflush(stdout);
         }
-    __exit:
-        xlink_unregister_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE_RESPONSE, handler_handle, &ret);
-        return ret;
     }
-};
+    close(epoll_fd);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    size_t failed = 0;
+    size_t acked = 0;
+    if (!options.verbose)
+    {
+        printf("\n%-24s %-6s %-6s %7s %8s %6s %8s  %s\n", "Device", "Result", "Target", "Baud", "Bytes", "Retx", "Seconds", "Note");
+    }
+    for (auto &device : fleet)
+    {
+        device->print_result();
+        failed += device->failed();
+        acked += device->acked_bytes();
+    }
+    if (!options.verbose)
+    {
+        printf("%zu of %zu devices %s in %.2f s, %.0f B/s aggregate\n",
+               fleet.size() - failed, fleet.size(), options.show_only ? "answered" : "upgraded",
+               seconds, seconds > 0 ? (double)acked / seconds : 0);
+    }
+    return failed == 0 ? 0 : -1;
+}
 
 int main(int argc, char *const *argv)
 {
-    static xlink_port_api_t tx_port = {
-        .malloc_fn = xlink_stdlib_malloc,
-        .free_fn = xlink_stdlib_free,
-        .mutex_create_fn = xlink_posix_mutex_create,
-        .mutex_delete_fn = xlink_posix_mutex_delete,
-        .mutex_lock_fn = xlink_posix_mutex_lock,
-        .mutex_unlock_fn = xlink_posix_mutex_unlock,
-        .transport_send_fn = xlink_transport_send,
-        .frame_send_alloc_fn = xlink_frame_send_alloc,
-    };
-
-    static const char short_options[] = "hd:f:s";
+    static const char short_options[] = "hd:f:sw:SDzj:b:";
     static struct option long_options[] = {
         {"help", 0, 0, 'h'},
         {"device", 1, 0, 'd'},
         {"file", 1, 0, 'f'},
         {"show", 0, 0, 's'},
+        {"window", 1, 0, 'w'},
+        {"sparse", 0, 0, 'S'},
+        {"diff", 0, 0, 'D'},
+        {"compress", 0, 0, 'z'},
+        {"jobs", 1, 0, 'j'},
+        {"baudrate", 1, 0, 'b'},
         {0, 0, 0, 0}};
 
     int c;
     int option_index = 0;
-    string *device_path = nullptr;
+    vector<string> device_paths;
     string *file_path = nullptr;
-    bool is_show_info = false;
+    upgrade_options options;
+    int firmware_fd = -1;
     int ret = 0;
-    BootFromInfo_t boot_from_info;
-    int firmware_fd;
-    std::thread *rx_thread;
-    xlink_partition_type_t target_partition;
-    upgrade_partition *app_partition;
-    upgrade_partition *bootfrom_partition;
 
     while ((c = getopt_long(argc, argv, short_options, long_options, &option_index)) != -1)
     {
@@ -357,13 +1385,35 @@ int main(int argc, char *const *argv)
             return 0;
             break;
         case 'd':
-            device_path = new string(optarg);
+            if (add_devices(optarg, device_paths) != 0)
+            {
+                printf("no device matches %s\n", optarg);
+                return -1;
+            }
             break;
         case 'f':
             file_path = new string(optarg);
             break;
         case 's':
-            is_show_info = true;
+            options.show_only = true;
+            break;
+        case 'w':
+            options.window = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            options.sparse = true;
+            break;
+        case 'D':
+            options.differential = true;
+            break;
+        case 'z':
+            options.compressed = true;
+            break;
+        case 'j':
+            options.jobs = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            options.max_baudrate = (uint32_t)strtoul(optarg, NULL, 0);
             break;
         default:
             usage();
@@ -372,168 +1422,23 @@ int main(int argc, char *const *argv)
         }
     }
 
-    if (!is_show_info && (device_path == nullptr || file_path == nullptr))
+    if (device_paths.empty() || (!options.show_only && file_path == nullptr))
     {
         usage();
         return -1;
     }
-
-    int serial_fd = open(device_path->c_str(), O_RDWR | O_NOCTTY);
-    if (serial_fd < 0)
+    options.window = options.window > 0 ? options.window : 1;
+    options.verbose = device_paths.size() == 1; // a single device is a fleet of one
+    if (!options.show_only && (firmware_fd = open(file_path->c_str(), O_RDONLY)) < 0)
     {
-        printf("open %s failed\n", device_path->c_str());
+        printf("open %s failed\n", file_path->c_str());
         return 1;
     }
-    serial_set_param(serial_fd, B115200);
-
-    xlink_context_p ctx = xlink_context_create(&tx_port, (void *)(size_t)serial_fd);
-    if (ctx == NULL)
-    {
-        printf("xlink context create failed\n");
-        goto __close_serial;
-    }
     signal(SIGINT, _close);
-
-    rx_thread = new thread([&]()
-                           {
-        uint8_t rx_buffer[256];
-        while (true)
-        {
-            ssize_t read_bytes = read(serial_fd, rx_buffer, sizeof(rx_buffer));
-            if (read_bytes > 0)
-            {
-                for (ssize_t i = 0; i < read_bytes; i++)
-                {
-                    xlink_process_rx(ctx, rx_buffer[i]);
-                }
-            }
-        } });
-    rx_thread->detach();
-
-    xlink_upgrade_firmware_info_t app_a_info;
-    xlink_upgrade_firmware_info_t app_b_info;
-    ret |= get_mcu_firmware_version(ctx, XLINK_PARTITION_TYPE_APP_A, &app_a_info);
-    ret |= get_mcu_firmware_version(ctx, XLINK_PARTITION_TYPE_APP_B, &app_b_info);
-    if (ret != 0)
-    {
-        printf("Failed to get firmware version\n");
-        goto __free_ctx;
-    }
-    target_partition = app_a_info.current_base_address == PARTITION_ADDRESS_APP_A
-                           ? XLINK_PARTITION_TYPE_APP_B
-                           : XLINK_PARTITION_TYPE_APP_A;
-    if (target_partition == XLINK_PARTITION_TYPE_APP_A)
-    {
-        printf("Current active partition: APP_B, will upgrade APP_A\n");
-    }
-    else
-    {
-        printf("Current active partition: APP_A, will upgrade APP_B\n");
-    }
-    if (is_show_info)
-    {
-        goto __free_ctx;
-    }
-    firmware_fd = open(file_path->c_str(), O_RDONLY);
-    if (firmware_fd < 0)
-    {
-        printf("open %s failed\n", file_path->c_str());
-        goto __free_ctx;
-    }
-    app_partition = new upgrade_partition(target_partition, ctx, firmware_fd);
-    ret = app_partition->perform_upgrade();
-    if (ret != 0)
-    {
-        printf("Firmware upgrade failed\n");
-        goto __close_frimware_fd;
-    }
-    delete app_partition;
-    boot_from_info.magicNumber = PARTITION_MAGIC_NUMBER;
-    boot_from_info.activeApp = target_partition == XLINK_PARTITION_TYPE_APP_A ? ACTIVE_APP_A : ACTIVE_APP_B;
-    memset(boot_from_info.reserved, 0, sizeof(boot_from_info.reserved));
-    boot_from_info.checksum = 0; // Assume checksum is calculated elsewhere
-    bootfrom_partition = new upgrade_partition(
-        PARTITION_ADDRESS_BOOTFROM,
-        PARTITION_SIZE_BOOTFROM,
-        "BOOTFROM",
-        ctx,
-        (const uint8_t *)&boot_from_info,
-        sizeof(BootFromInfo_t));
-    ret = bootfrom_partition->perform_upgrade();
-    if (ret != 0)
-    {
-        printf("BootFrom partition upgrade failed\n");
-        goto __close_frimware_fd;
-    }
-
-    printf("Firmware upgrade completed successfully\n");
-
-    printf("Reset the device to boot into the new firmware\n");
-
-    xlink_upgrade_restart_device_send(ctx, true);
-
-    tcflush(serial_fd, TCIOFLUSH);
-
-__close_frimware_fd:
-    close(firmware_fd);
-__free_ctx:
-    xlink_context_delete(ctx);
-__close_serial:
-    close(serial_fd);
-    return 0;
-}
-
-static int get_mcu_firmware_version(xlink_context_p ctx, xlink_partition_type_t partition_type, xlink_upgrade_firmware_info_t *out_info)
-{
-    static xlink_msg_handler_t handler_handle = nullptr;
-    int timeout = 100; // 100ms
-    out_info->current_base_address = 0;
-    handler_handle = xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_INFO, [](uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data) -> int
-                                                {
-                                     (void)comp_id;
-                                     (void)msg_id;
-                                     string partition_str[] = {"BOOTLOADER", "APP_A", "APP_B"};
-                                     if (payload_len != sizeof(xlink_upgrade_firmware_info_t))
-                                     {
-                                        printf("Invalid firmware info length: %u\n", payload_len);
-                                        return -1;
-                                     }
-                                     const xlink_upgrade_firmware_info_t *info = (const xlink_upgrade_firmware_info_t *)payload;
-                                        printf("\n==============================\n");
-                                        printf("Partition Type: %s\n",info->partition_type < sizeof(partition_str)/sizeof(partition_str[0]) ? partition_str[info->partition_type].c_str() : "UNKNOWN");
-                                        printf("Firmware Version: v%d.%d.%d\n", (info->version >> 16) & 0xFF, (info->version >> 8) & 0xFF, info->version & 0xFF);
-                                        printf("Firmware Size: %u bytes\n", info->size_bytes);
-                                        printf("Commit Hash: %x\n", info->commit_hash);
-                                        time_t compile_time = (time_t)info->compile_timestamp;
-                                        struct tm *timeinfo = localtime(&compile_time);
-                                        char time_str[32];
-                                        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", timeinfo);
-                                        printf("Compile Timestamp: %s\n", time_str);
-                                        printf("Current Base Address: 0x%08X\n", info->current_base_address);
-                                        printf("==============================\n");
-                                        if (user_data != nullptr)
-                                        {
-                                            xlink_upgrade_firmware_info_t *out = (xlink_upgrade_firmware_info_t *)user_data;
-                                            memcpy(out, info, sizeof(xlink_upgrade_firmware_info_t));
-                                        }
-                                     return 0; }, out_info);
-    if (handler_handle == nullptr)
-    {
-        return -1;
-    }
-    xlink_upgrade_get_firmware_info_send(ctx, partition_type);
-    while (out_info->current_base_address == 0 && timeout > 0)
-    {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        timeout--;
-    }
-    if (out_info->current_base_address == 0)
-    {
-        printf("Get firmware info timeout\n");
-    }
-    if (handler_handle)
+    ret = fleet_upgrade(device_paths, firmware_fd, options);
+    if (firmware_fd >= 0)
     {
-        xlink_unregister_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_INFO, handler_handle, out_info);
+        close(firmware_fd);
     }
-    return out_info->current_base_address == 0 ? -1 : 0;
+    return ret == 0 ? 0 : 1;
 }
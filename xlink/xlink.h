@@ -34,6 +34,11 @@ typedef struct xlink_message_list_element_def
 #define XLINK_CRC_16
 #define XLINK_INIT_CRC16 0xFFFF
 
+/*
+ * Entries 60..63 differ from the CRC-16/X.25 table this was derived from, so
+ * the table is not linear and slicing-by-N cannot reproduce it. Both ends of
+ * the wire depend on it as is.
+ */
 static const uint16_t crc_table[256] = {
     0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF,
     0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
@@ -94,22 +99,27 @@ typedef int (*xlink_msg_handler_t)(uint8_t comp_id,
                                    uint8_t payload_len,
                                    void *user_data);
 
+#ifndef XLINK_MAX_COMPONENTS
+#define XLINK_MAX_COMPONENTS 4u // distinct comp_ids that can have handlers
+#endif
+#ifndef XLINK_MAX_MSG_IDS
+#define XLINK_MAX_MSG_IDS 32u // msg_ids 0..XLINK_MAX_MSG_IDS-1 per component
+#endif
+#ifndef XLINK_MAX_HANDLERS
+#define XLINK_MAX_HANDLERS 32u // registered handlers over all components
+#endif
+#define XLINK_NO_SLOT 0xFFu
+#if XLINK_MAX_HANDLERS >= XLINK_NO_SLOT || XLINK_MAX_COMPONENTS >= XLINK_NO_SLOT
+#error "xlink handler slots and component rows are indexed by uint8_t"
+#endif
+
 typedef struct xlink_message_handler_element_def
 {
-    uint8_t msg_id;
     xlink_msg_handler_t handler;
     void *user_data;
-    struct xlink_message_handler_element_def *next;
+    uint8_t next; // next slot for the same comp_id/msg_id, or next free slot
 } xlink_msg_id_handler_element_t, *xlink_message_handler_element_p;
 
-typedef struct xlink_comp_id_handler_element_def
-{
-    uint8_t comp_id;
-    xlink_message_handler_element_p handlers_list;
-    xlink_message_handler_element_p *handlers_list_pos;
-    struct xlink_comp_id_handler_element_def *next;
-} xlink_comp_id_handler_element_t, *xlink_comp_id_handler_element_p;
-
 enum xlink_msg_rx_state
 {
     XLINK_MSG_RX_WAIT_MAGIC,
@@ -124,8 +134,12 @@ typedef struct xlink_context_def
     void *transport_handle;
 
     void *global_mutex;
-    xlink_comp_id_handler_element_p comp_id_handler_map;
-    xlink_comp_id_handler_element_p *comp_id_handler_map_pos;
+    // handlers of comp_id/msg_id start at handler_slots[msg_handlers[comp_row[comp_id]][msg_id]]
+    uint8_t comp_row[256];
+    uint8_t comp_rows_used;
+    uint8_t msg_handlers[XLINK_MAX_COMPONENTS][XLINK_MAX_MSG_IDS];
+    xlink_msg_id_handler_element_t handler_slots[XLINK_MAX_HANDLERS];
+    uint8_t free_slot;
 
     enum xlink_msg_rx_state rx_msg_state;
     xlink_message_t rx_msg;
@@ -151,8 +165,25 @@ static inline xlink_context_p xlink_context_create(const xlink_port_api_t *port,
 
     context->port = port;
     context->transport_handle = transport_handle;
-    context->comp_id_handler_map = NULL;
-    context->comp_id_handler_map_pos = &context->comp_id_handler_map;
+    for (size_t i = 0; i < sizeof(context->comp_row); i++)
+    {
+        context->comp_row[i] = XLINK_NO_SLOT;
+    }
+    context->comp_rows_used = 0;
+    for (size_t row = 0; row < XLINK_MAX_COMPONENTS; row++)
+    {
+        for (size_t msg_id = 0; msg_id < XLINK_MAX_MSG_IDS; msg_id++)
+        {
+            context->msg_handlers[row][msg_id] = XLINK_NO_SLOT;
+        }
+    }
+    for (size_t slot = 0; slot < XLINK_MAX_HANDLERS; slot++)
+    {
+        context->handler_slots[slot].handler = NULL;
+        context->handler_slots[slot].user_data = NULL;
+        context->handler_slots[slot].next = slot + 1 < XLINK_MAX_HANDLERS ? (uint8_t)(slot + 1) : XLINK_NO_SLOT;
+    }
+    context->free_slot = 0;
     context->rx_msg_pos = 0;
     context->rx_msg_crc = 0;
     context->rx_msg_state = XLINK_MSG_RX_WAIT_MAGIC;
@@ -189,21 +220,6 @@ static inline void xlink_context_delete(xlink_context_p context)
         port->mutex_delete_fn(context->global_mutex);
     }
 
-    xlink_comp_id_handler_element_p comp_id_element = context->comp_id_handler_map;
-    while (comp_id_element != NULL)
-    {
-        xlink_message_handler_element_p handler_element = comp_id_element->handlers_list;
-        while (handler_element != NULL)
-        {
-            xlink_message_handler_element_p next_handler = handler_element->next;
-            port->free_fn(handler_element);
-            handler_element = next_handler;
-        }
-        xlink_comp_id_handler_element_p next_comp_id_element = comp_id_element->next;
-        port->free_fn(comp_id_element);
-        comp_id_element = next_comp_id_element;
-    }
-
     port->free_fn(context);
 }
 
@@ -213,7 +229,7 @@ static inline xlink_msg_handler_t xlink_register_msg_handler(xlink_context_p con
                                                              xlink_msg_handler_t handler,
                                                              void *user_data)
 {
-    if (context == NULL)
+    if (context == NULL || handler == NULL || msg_id >= XLINK_MAX_MSG_IDS)
     {
         return NULL;
     }
@@ -222,56 +238,42 @@ static inline xlink_msg_handler_t xlink_register_msg_handler(xlink_context_p con
         return NULL;
     }
 
-    xlink_comp_id_handler_element_p comp_id_element = context->comp_id_handler_map;
-    while (comp_id_element != NULL)
+    uint8_t row = context->comp_row[comp_id];
+    if (row == XLINK_NO_SLOT)
     {
-        if (comp_id_element->comp_id == comp_id)
-        {
-            break;
-        }
-        comp_id_element = comp_id_element->next;
-    }
-    if (comp_id_element == NULL)
-    {
-        comp_id_element = (xlink_comp_id_handler_element_p)context->port->malloc_fn(sizeof(xlink_comp_id_handler_element_t));
-        if (comp_id_element == NULL)
+        if (context->comp_rows_used == XLINK_MAX_COMPONENTS)
         {
             xlink_port_mutex_unlock(context->port, context->global_mutex);
-            return NULL;
+            return NULL; // no row left for another component
         }
-        comp_id_element->comp_id = comp_id;
-        comp_id_element->handlers_list = NULL;
-        comp_id_element->handlers_list_pos = &comp_id_element->handlers_list;
-        comp_id_element->next = NULL;
-        *context->comp_id_handler_map_pos = comp_id_element;
-        context->comp_id_handler_map_pos = &comp_id_element->next;
+        row = context->comp_rows_used++;
+        context->comp_row[comp_id] = row;
     }
 
-    xlink_message_handler_element_p msg_id_pos = comp_id_element->handlers_list;
-    while (msg_id_pos != NULL)
+    uint8_t *pos = &context->msg_handlers[row][msg_id];
+    while (*pos != XLINK_NO_SLOT)
     {
-        if (msg_id_pos->msg_id == msg_id &&
-            msg_id_pos->handler == handler &&
-            msg_id_pos->user_data == user_data)
+        xlink_message_handler_element_p element = &context->handler_slots[*pos];
+        if (element->handler == handler && element->user_data == user_data)
         {
             xlink_port_mutex_unlock(context->port, context->global_mutex);
             return NULL; // Handler already registered
         }
-        msg_id_pos = msg_id_pos->next;
+        pos = &element->next;
     }
 
-    xlink_message_handler_element_p new_handler_element = (xlink_message_handler_element_p)context->port->malloc_fn(sizeof(xlink_msg_id_handler_element_t));
-    if (new_handler_element == NULL)
+    uint8_t slot = context->free_slot;
+    if (slot == XLINK_NO_SLOT)
     {
         xlink_port_mutex_unlock(context->port, context->global_mutex);
-        return NULL;
+        return NULL; // all XLINK_MAX_HANDLERS slots in use
     }
-    new_handler_element->msg_id = msg_id;
+    xlink_message_handler_element_p new_handler_element = &context->handler_slots[slot];
+    context->free_slot = new_handler_element->next;
     new_handler_element->handler = handler;
     new_handler_element->user_data = user_data;
-    new_handler_element->next = NULL;
-    *comp_id_element->handlers_list_pos = new_handler_element;
-    comp_id_element->handlers_list_pos = &new_handler_element->next;
+    new_handler_element->next = XLINK_NO_SLOT;
+    *pos = slot; // append, handlers run in registration order
     xlink_port_mutex_unlock(context->port, context->global_mutex);
     return handler;
 }
@@ -291,46 +293,135 @@ static inline int xlink_unregister_msg_handler(xlink_context_p context,
         return -2;
     }
 
-    xlink_comp_id_handler_element_p comp_id_element = context->comp_id_handler_map;
-    while (comp_id_element != NULL)
-    {
-        if (comp_id_element->comp_id == comp_id)
-        {
-            break;
-        }
-        comp_id_element = comp_id_element->next;
-    }
-    if (comp_id_element == NULL)
+    uint8_t row = context->comp_row[comp_id];
+    if (row == XLINK_NO_SLOT)
     {
         xlink_port_mutex_unlock(context->port, context->global_mutex);
         return -3; // Component ID not found
     }
 
-    xlink_message_handler_element_p *msg_id_pos = &comp_id_element->handlers_list;
-    xlink_message_handler_element_p current = comp_id_element->handlers_list;
-    while (current != NULL)
+    uint8_t *pos = msg_id < XLINK_MAX_MSG_IDS ? &context->msg_handlers[row][msg_id] : NULL;
+    while (pos != NULL && *pos != XLINK_NO_SLOT)
     {
-        if (current->msg_id == msg_id &&
-            current->handler == handler &&
+        uint8_t slot = *pos;
+        xlink_message_handler_element_p current = &context->handler_slots[slot];
+        if (current->handler == handler &&
             current->user_data == user_data)
         {
-            *msg_id_pos = current->next;
-            if (comp_id_element->handlers_list_pos == &current->next)
-            {
-                comp_id_element->handlers_list_pos = msg_id_pos;
-            }
-            context->port->free_fn(current);
+            *pos = current->next;
+            current->handler = NULL;
+            current->user_data = NULL;
+            current->next = context->free_slot;
+            context->free_slot = slot;
             xlink_port_mutex_unlock(context->port, context->global_mutex);
             return 0; // Successfully unregistered
         }
-        msg_id_pos = &current->next;
-        current = current->next;
+        pos = &current->next;
     }
 
     xlink_port_mutex_unlock(context->port, context->global_mutex);
     return -4; // Handler not found
 }
 
+static inline uint16_t _xlink_copy_with_crc16(uint8_t *dst, const uint8_t *src, size_t count, uint16_t crc)
+{
+    while (count--)
+    {
+        uint8_t c = *src++;
+        *dst++ = c;
+        crc = (crc >> 8) ^ crc_table[(c ^ crc) & 0xFF];
+    }
+    return crc;
+}
+
+typedef size_t __attribute__((may_alias)) xlink_word_t;
+
+// memchr(XLINK_SOF) without libc, the firmware is linked with -nostdlib
+static inline const uint8_t *_xlink_find_sof(const uint8_t *data, const uint8_t *end)
+{
+    const xlink_word_t ones = (xlink_word_t)-1 / 0xFF; // 0x01 in every byte
+    const xlink_word_t highs = ones << 7;
+    const xlink_word_t pattern = ones * XLINK_SOF;
+
+    while (data < end && ((size_t)data % sizeof(xlink_word_t)) != 0)
+    {
+        if (*data == XLINK_SOF)
+        {
+            return data;
+        }
+        data++;
+    }
+    while ((size_t)(end - data) >= sizeof(xlink_word_t))
+    {
+        xlink_word_t v = *(const xlink_word_t *)data ^ pattern;
+        if (((v - ones) & ~v & highs) != 0)
+        {
+            break; // a byte of this word is XLINK_SOF
+        }
+        data += sizeof(xlink_word_t);
+    }
+    while (data < end && *data != XLINK_SOF)
+    {
+        data++;
+    }
+    return data;
+}
+
+static inline int _xlink_rx_msg_complete(xlink_context_p context)
+{
+    context->rx_msg_state = XLINK_MSG_RX_WAIT_MAGIC;
+    if (context->rx_msg.crc != context->rx_msg_crc)
+    {
+        return -2; // CRC error
+    }
+    // Valid message received
+    // call handler
+    uint8_t row = context->comp_row[context->rx_msg.comp_id];
+    if (row == XLINK_NO_SLOT || context->rx_msg.msg_id >= XLINK_MAX_MSG_IDS)
+    {
+        return 0;
+    }
+    uint8_t slot = context->msg_handlers[row][context->rx_msg.msg_id];
+    while (slot != XLINK_NO_SLOT)
+    {
+        xlink_message_handler_element_p handler_element = &context->handler_slots[slot];
+        xlink_msg_handler_t handler = handler_element->handler;
+        void *user_data = handler_element->user_data;
+        slot = handler_element->next; // the handler may unregister itself
+        if (handler != NULL)
+        {
+            handler(context->rx_msg.comp_id,
+                    context->rx_msg.msg_id,
+                    context->rx_msg.payload,
+                    context->rx_msg.len,
+                    user_data);
+        }
+    }
+    return 0;
+}
+
+static inline void _xlink_rx_msg_start(xlink_context_p context)
+{
+    context->rx_msg.sof = XLINK_SOF;
+    context->expected_len = 3; // LEN + COMP_ID + MSG_ID
+    context->rx_msg_pos = 0;
+    context->rx_msg_state = XLINK_MSG_RX_WAIT_ID_LENGTH;
+    context->rx_msg_crc = XLINK_INIT_CRC16;
+}
+
+static inline void _xlink_rx_header_complete(xlink_context_p context)
+{
+    if (context->rx_msg.len > XLINK_MAX_PAYLOAD)
+    {
+        // cannot be a frame of ours, the payload would overrun rx_msg
+        context->rx_msg_state = XLINK_MSG_RX_WAIT_MAGIC;
+        return;
+    }
+    context->expected_len = context->rx_msg.len + 2; // Add payload length + CRC
+    context->rx_msg_state = XLINK_MSG_RX_WAIT_PAYLOAD;
+    context->rx_msg_pos = 0;
+}
+
 static inline int xlink_process_rx(xlink_context_p context,
                                    uint8_t data)
 {
@@ -339,11 +430,7 @@ static inline int xlink_process_rx(xlink_context_p context,
     case XLINK_MSG_RX_WAIT_MAGIC:
         if (data == XLINK_SOF)
         {
-            context->rx_msg.sof = data;
-            context->expected_len = 3; // LEN + COMP_ID + MSG_ID
-            context->rx_msg_pos = 0;
-            context->rx_msg_state = XLINK_MSG_RX_WAIT_ID_LENGTH;
-            context->rx_msg_crc = XLINK_INIT_CRC16;
+            _xlink_rx_msg_start(context);
         }
         break;
 
@@ -354,9 +441,7 @@ static inline int xlink_process_rx(xlink_context_p context,
         context->rx_msg_pos++;
         if (context->rx_msg_pos == context->expected_len)
         {
-            context->expected_len = context->rx_msg.len + 2; // Add payload length + CRC
-            context->rx_msg_state = XLINK_MSG_RX_WAIT_PAYLOAD;
-            context->rx_msg_pos = 0;
+            _xlink_rx_header_complete(context);
         }
     }
     break;
@@ -377,94 +462,169 @@ static inline int xlink_process_rx(xlink_context_p context,
         }
         if (context->rx_msg_pos == context->expected_len)
         {
-            context->rx_msg_state = XLINK_MSG_RX_WAIT_MAGIC;
-            if (context->rx_msg.crc == context->rx_msg_crc)
+            return _xlink_rx_msg_complete(context);
+        }
+    }
+    break;
+    }
+    return -1;
+}
+
+/*
+ * Feed a block of received bytes. Frames are parsed exactly as if every byte
+ * was passed to xlink_process_rx(), but the SOF search scans a word at a time
+ * and header, payload and CRC are copied span by span.
+ * Returns the number of valid messages dispatched.
+ */
+static inline int xlink_process_rx_buffer(xlink_context_p context,
+                                          const uint8_t *data,
+                                          size_t len)
+{
+    const uint8_t *end = data + len;
+    int messages = 0;
+
+    while (data < end)
+    {
+        size_t avail = (size_t)(end - data);
+        size_t n;
+        switch (context->rx_msg_state)
+        {
+        case XLINK_MSG_RX_WAIT_MAGIC:
+            data = _xlink_find_sof(data, end);
+            if (data == end)
             {
-                // Valid message received
-                // call handler
-                xlink_comp_id_handler_element_p comp_id_element = context->comp_id_handler_map;
-                while (comp_id_element)
+                return messages;
+            }
+            data++;
+            _xlink_rx_msg_start(context);
+            break;
+
+        case XLINK_MSG_RX_WAIT_ID_LENGTH:
+            n = context->expected_len - context->rx_msg_pos;
+            n = n < avail ? n : avail;
+            context->rx_msg_crc = _xlink_copy_with_crc16(&context->rx_msg.len + context->rx_msg_pos,
+                                                         data,
+                                                         n,
+                                                         context->rx_msg_crc);
+            data += n;
+            context->rx_msg_pos += n;
+            if (context->rx_msg_pos == context->expected_len)
+            {
+                _xlink_rx_header_complete(context);
+            }
+            break;
+
+        case XLINK_MSG_RX_WAIT_PAYLOAD:
+        case XLINK_MSG_RX_WAIT_CHECKSUM:
+            if (context->rx_msg_pos < context->expected_len - 2)
+            {
+                n = context->expected_len - 2 - context->rx_msg_pos;
+                n = n < avail ? n : avail;
+                context->rx_msg_crc = _xlink_copy_with_crc16(&context->rx_msg.payload[context->rx_msg_pos],
+                                                             data,
+                                                             n,
+                                                             context->rx_msg_crc);
+            }
+            else
+            {
+                // Receiving CRC bytes
+                n = context->expected_len - context->rx_msg_pos;
+                n = n < avail ? n : avail;
+                for (size_t i = 0; i < n; i++)
                 {
-                    if (comp_id_element->comp_id == context->rx_msg.comp_id)
-                    {
-                        xlink_message_handler_element_p handler_element = comp_id_element->handlers_list;
-                        while (handler_element)
-                        {
-                            if (handler_element->msg_id == context->rx_msg.msg_id)
-                            {
-                                handler_element->handler(context->rx_msg.comp_id,
-                                                         context->rx_msg.msg_id,
-                                                         context->rx_msg.payload,
-                                                         context->rx_msg.len,
-                                                         handler_element->user_data);
-                            }
-                            handler_element = handler_element->next;
-                        }
-                        break;
-                    }
-                    comp_id_element = comp_id_element->next;
+                    ((uint8_t *)(&context->rx_msg.crc))[context->rx_msg_pos + i - (context->expected_len - 2)] = data[i];
                 }
-                return 0;
             }
-            return -2; // CRC error
+            data += n;
+            context->rx_msg_pos += n;
+            if (context->rx_msg_pos == context->expected_len && _xlink_rx_msg_complete(context) == 0)
+            {
+                messages++;
+            }
+            break;
         }
     }
-    break;
-    }
-    return -1;
+    return messages;
 }
 
 static inline void _memcpy_and_crc16(void *dst, const void *src, size_t count, uint16_t crc)
 {
     uint8_t *dst_ptr = (uint8_t *)dst;
-    const uint8_t *src_ptr = (const uint8_t *)src;
 
-    while (count--)
-    {
-        *dst_ptr = *src_ptr;
-        crc = (crc >> 8) ^ crc_table[(*src_ptr ^ (crc & 0xFF)) & 0xFF];
-        dst_ptr++;
-        src_ptr++;
-    }
+    crc = _xlink_copy_with_crc16(dst_ptr, (const uint8_t *)src, count, crc);
+    dst_ptr += count;
     *dst_ptr++ = (uint8_t)(crc & 0xFF);
     *dst_ptr = (uint8_t)((crc >> 8) & 0xFF);
 }
 
-static inline int xlink_send(xlink_context_p context,
-                             uint8_t comp_id,
-                             uint8_t msg_id,
-                             const uint8_t *payload,
-                             uint8_t payload_len)
+/*
+ * Reserve a frame for payload_len bytes of payload and fill in its header.
+ * Returns where the payload goes, the caller writes the fixed fields there
+ * and hands the frame to xlink_frame_finish(), which must always follow.
+ */
+static inline void *xlink_frame_prepare(xlink_context_p context,
+                                        xlink_frame_t **frame,
+                                        uint8_t comp_id,
+                                        uint8_t msg_id,
+                                        uint8_t payload_len)
 {
     if (context == NULL || context->port == NULL || context->port->transport_send_fn == NULL)
     {
-        return -1;
-    }
-    if (payload_len > 0u && payload == NULL)
-    {
-        return -1;
+        return NULL;
     }
     if (payload_len > XLINK_MAX_PAYLOAD)
     {
-        return -1;
+        return NULL;
     }
-    xlink_frame_t *frame = context->port->frame_send_alloc_fn(context->transport_handle,
-                                                              (uint16_t)(XLINK_LENGTH_OF_HEADER + payload_len + XLINK_LENGTH_OF_CRC));
-    if (frame == NULL)
+    *frame = context->port->frame_send_alloc_fn(context->transport_handle,
+                                                (uint16_t)(XLINK_LENGTH_OF_HEADER + payload_len + XLINK_LENGTH_OF_CRC));
+    if (*frame == NULL)
     {
-        return -1;
+        return NULL;
     }
-    uint16_t crc = XLINK_INIT_CRC16;
-    xlink_message_p msg = (xlink_message_p)(frame->buffer);
-    frame->size = (uint16_t)(XLINK_LENGTH_OF_HEADER + payload_len + XLINK_LENGTH_OF_CRC);
+    xlink_message_p msg = (xlink_message_p)((*frame)->buffer);
+    (*frame)->size = (uint16_t)(XLINK_LENGTH_OF_HEADER + payload_len + XLINK_LENGTH_OF_CRC);
     msg->sof = XLINK_SOF;
     msg->len = payload_len;
     msg->comp_id = comp_id;
     msg->msg_id = msg_id;
-    crc = xlink_crc16_with_init(&msg->len, 3, crc);
-    _memcpy_and_crc16(msg->payload, payload, payload_len, crc);
+    return msg->payload;
+}
+
+/*
+ * Copy tail_len bytes of tail behind the fixed fields already written to the
+ * frame, append the CRC and send it. The tail is read once, the copy and the
+ * CRC share the pass.
+ */
+static inline int xlink_frame_finish(xlink_context_p context,
+                                     xlink_frame_t *frame,
+                                     const uint8_t *tail,
+                                     uint8_t tail_len)
+{
+    xlink_message_p msg = (xlink_message_p)(frame->buffer);
+    uint8_t fixed_len = (uint8_t)(msg->len - tail_len);
+    uint16_t crc = xlink_crc16_with_init(&msg->len, (uint16_t)(3 + fixed_len), XLINK_INIT_CRC16);
+    _memcpy_and_crc16(msg->payload + fixed_len, tail, tail_len, crc);
 
     return context->port->transport_send_fn(context->transport_handle, frame);
 }
 
+static inline int xlink_send(xlink_context_p context,
+                             uint8_t comp_id,
+                             uint8_t msg_id,
+                             const uint8_t *payload,
+                             uint8_t payload_len)
+{
+    if (payload_len > 0u && payload == NULL)
+    {
+        return -1;
+    }
+    xlink_frame_t *frame;
+    if (xlink_frame_prepare(context, &frame, comp_id, msg_id, payload_len) == NULL)
+    {
+        return -1;
+    }
+    return xlink_frame_finish(context, frame, payload, payload_len);
+}
+
 #endif // XLINK_H
@@ -218,7 +218,7 @@ def generate_header(component, messages_map, enum_map) -> str:
 
         lines.append(f"static inline int xlink_{comp_snake}_{msg_snake}_send({', '.join(params)})")
         lines.append("{")
-        lines.append(f"    {type_name} msg;")
+        lines.append("    xlink_frame_t *frame;")
         if bytes_field is not None:
             bytes_name = bytes_field["name"]
             lines.append(f"    if ({bytes_name}_len > 0u && {bytes_name} == NULL)")
@@ -229,29 +229,42 @@ def generate_header(component, messages_map, enum_map) -> str:
             lines.append("    {")
             lines.append("        return -1;")
             lines.append("    }")
+        # every check happens before the frame is reserved, a reserved frame is always sent
+        for field in fields:
+            info = parse_type(field["type"], enum_map)
+            if info["kind"] == "array":
+                lines.append(f"    if ({field['name']} == NULL)")
+                lines.append("    {")
+                lines.append("        return -1;")
+                lines.append("    }")
+
+        if bytes_field is not None:
+            payload_len = f"(uint8_t)({fixed_size}u + {bytes_field['name']}_len)"
+        else:
+            payload_len = f"(uint8_t)sizeof({type_name})"
+        lines.append(f"    {type_name} *msg = ({type_name} *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_{comp_upper}, XLINK_{comp_upper}_MSG_ID_{msg_upper}, {payload_len});")
+        lines.append("    if (msg == NULL)")
+        lines.append("    {")
+        lines.append("        return -1;")
+        lines.append("    }")
 
         for field in fields:
             info = parse_type(field["type"], enum_map)
             fname = field["name"]
             if info["kind"] == "bytes":
-                lines.append(f"    msg.{fname}_len = {fname}_len;")
-                lines.append(f"    memcpy(msg.{fname}, {fname}, {fname}_len);")
+                lines.append(f"    msg->{fname}_len = {fname}_len;")
                 continue
             if info["kind"] == "array":
                 count = info["count"]
-                lines.append(f"    if ({fname} == NULL)")
-                lines.append("    {")
-                lines.append("        return -1;")
-                lines.append("    }")
-                lines.append(f"    memcpy(msg.{fname}, {fname}, sizeof(msg.{fname}[0]) * {count}u);")
+                lines.append(f"    memcpy(msg->{fname}, {fname}, sizeof(msg->{fname}[0]) * {count}u);")
                 continue
-            lines.append(f"    msg.{fname} = {fname};")
+            lines.append(f"    msg->{fname} = {fname};")
 
         if bytes_field is not None:
             bytes_name = bytes_field["name"]
-            lines.append(f"    return xlink_send(context, XLINK_COMP_ID_{comp_upper}, XLINK_{comp_upper}_MSG_ID_{msg_upper}, (const uint8_t *)&msg, (uint8_t)({fixed_size}u + msg.{bytes_name}_len));")
+            lines.append(f"    return xlink_frame_finish(context, frame, {bytes_name}, {bytes_name}_len);")
         else:
-            lines.append(f"    return xlink_send(context, XLINK_COMP_ID_{comp_upper}, XLINK_{comp_upper}_MSG_ID_{msg_upper}, (const uint8_t *)&msg, (uint8_t)sizeof(msg));")
+            lines.append("    return xlink_frame_finish(context, frame, NULL, 0);")
         lines.append("}")
         lines.append("")
 
@@ -18,12 +18,28 @@
 #define XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE 6
 #define XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE_RESPONSE 7
 #define XLINK_UPGRADE_MSG_ID_RESTART_DEVICE 8
+#define XLINK_UPGRADE_MSG_ID_GET_PAGE_DIGESTS 9
+#define XLINK_UPGRADE_MSG_ID_PAGE_DIGESTS 10
+#define XLINK_UPGRADE_MSG_ID_SET_BAUDRATE 11
+#define XLINK_UPGRADE_MSG_ID_SET_BAUDRATE_RESPONSE 12
+#define XLINK_UPGRADE_MSG_ID_CONFIRM_BAUDRATE 13
+#define XLINK_UPGRADE_MSG_ID_BAUDRATE_CONFIRMED 14
+#define XLINK_UPGRADE_MSG_ID_GET_SESSION_PROGRESS 15
+#define XLINK_UPGRADE_MSG_ID_SESSION_PROGRESS 16
+#define XLINK_UPGRADE_MSG_ID_GET_DEVICE_INVENTORY 17
+#define XLINK_UPGRADE_MSG_ID_DEVICE_INVENTORY 18
 
 typedef uint8_t xlink_partition_type_t;
 #define XLINK_PARTITION_TYPE_BOOTLOADER 0
 #define XLINK_PARTITION_TYPE_APP_A 1
 #define XLINK_PARTITION_TYPE_APP_B 2
 
+typedef uint8_t xlink_upgrade_flag_t;
+#define XLINK_UPGRADE_FLAG_NONE 0
+#define XLINK_UPGRADE_FLAG_PAGE_ERASE 1
+#define XLINK_UPGRADE_FLAG_COMPRESSED 2
+#define XLINK_UPGRADE_FLAG_RESUME 4
+
 typedef xlink_packed(struct xlink_upgrade_get_firmware_info_t_def
 {
     xlink_partition_type_t required_partition;
@@ -31,9 +47,14 @@ typedef xlink_packed(struct xlink_upgrade_get_firmware_info_t_def
 
 static inline int xlink_upgrade_get_firmware_info_send(xlink_context_p context, xlink_partition_type_t required_partition)
 {
-    xlink_upgrade_get_firmware_info_t msg;
-    msg.required_partition = required_partition;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_GET_FIRMWARE_INFO, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_get_firmware_info_t *msg = (xlink_upgrade_get_firmware_info_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_GET_FIRMWARE_INFO, (uint8_t)sizeof(xlink_upgrade_get_firmware_info_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->required_partition = required_partition;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 typedef xlink_packed(struct xlink_upgrade_firmware_info_t_def
@@ -48,14 +69,19 @@ typedef xlink_packed(struct xlink_upgrade_firmware_info_t_def
 
 static inline int xlink_upgrade_firmware_info_send(xlink_context_p context, xlink_partition_type_t partition_type, uint32_t version, uint32_t size_bytes, uint32_t commit_hash, uint32_t compile_timestamp, uint32_t current_base_address)
 {
-    xlink_upgrade_firmware_info_t msg;
-    msg.partition_type = partition_type;
-    msg.version = version;
-    msg.size_bytes = size_bytes;
-    msg.commit_hash = commit_hash;
-    msg.compile_timestamp = compile_timestamp;
-    msg.current_base_address = current_base_address;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_INFO, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_firmware_info_t *msg = (xlink_upgrade_firmware_info_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_INFO, (uint8_t)sizeof(xlink_upgrade_firmware_info_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->partition_type = partition_type;
+    msg->version = version;
+    msg->size_bytes = size_bytes;
+    msg->commit_hash = commit_hash;
+    msg->compile_timestamp = compile_timestamp;
+    msg->current_base_address = current_base_address;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 typedef xlink_packed(struct xlink_upgrade_start_firmware_upgrade_t_def
@@ -63,15 +89,24 @@ typedef xlink_packed(struct xlink_upgrade_start_firmware_upgrade_t_def
     uint32_t start_address;
     uint32_t size_bytes;
     uint32_t chunk_size;
+    xlink_upgrade_flag_t flags;
+    uint32_t session_id;
 }) xlink_upgrade_start_firmware_upgrade_t;
 
-static inline int xlink_upgrade_start_firmware_upgrade_send(xlink_context_p context, uint32_t start_address, uint32_t size_bytes, uint32_t chunk_size)
+static inline int xlink_upgrade_start_firmware_upgrade_send(xlink_context_p context, uint32_t start_address, uint32_t size_bytes, uint32_t chunk_size, xlink_upgrade_flag_t flags, uint32_t session_id)
 {
-    xlink_upgrade_start_firmware_upgrade_t msg;
-    msg.start_address = start_address;
-    msg.size_bytes = size_bytes;
-    msg.chunk_size = chunk_size;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_start_firmware_upgrade_t *msg = (xlink_upgrade_start_firmware_upgrade_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE, (uint8_t)sizeof(xlink_upgrade_start_firmware_upgrade_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->start_address = start_address;
+    msg->size_bytes = size_bytes;
+    msg->chunk_size = chunk_size;
+    msg->flags = flags;
+    msg->session_id = session_id;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 typedef xlink_packed(struct xlink_upgrade_start_firmware_upgrade_response_t_def
@@ -81,9 +116,14 @@ typedef xlink_packed(struct xlink_upgrade_start_firmware_upgrade_response_t_def
 
 static inline int xlink_upgrade_start_firmware_upgrade_response_send(xlink_context_p context, bool accepted)
 {
-    xlink_upgrade_start_firmware_upgrade_response_t msg;
-    msg.accepted = accepted;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE_RESPONSE, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_start_firmware_upgrade_response_t *msg = (xlink_upgrade_start_firmware_upgrade_response_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_START_FIRMWARE_UPGRADE_RESPONSE, (uint8_t)sizeof(xlink_upgrade_start_firmware_upgrade_response_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->accepted = accepted;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 #define XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN (XLINK_MAX_PAYLOAD - 5u)
@@ -97,7 +137,7 @@ typedef xlink_packed(struct xlink_upgrade_firmware_chunk_t_def
 
 static inline int xlink_upgrade_firmware_chunk_send(xlink_context_p context, uint32_t offset, const uint8_t *data, uint8_t data_len)
 {
-    xlink_upgrade_firmware_chunk_t msg;
+    xlink_frame_t *frame;
     if (data_len > 0u && data == NULL)
     {
         return -1;
@@ -106,10 +146,14 @@ static inline int xlink_upgrade_firmware_chunk_send(xlink_context_p context, uin
     {
         return -1;
     }
-    msg.offset = offset;
-    msg.data_len = data_len;
-    memcpy(msg.data, data, data_len);
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK, (const uint8_t *)&msg, (uint8_t)(5u + msg.data_len));
+    xlink_upgrade_firmware_chunk_t *msg = (xlink_upgrade_firmware_chunk_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK, (uint8_t)(5u + data_len));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->offset = offset;
+    msg->data_len = data_len;
+    return xlink_frame_finish(context, frame, data, data_len);
 }
 
 typedef xlink_packed(struct xlink_upgrade_firmware_chunk_response_t_def
@@ -120,10 +164,15 @@ typedef xlink_packed(struct xlink_upgrade_firmware_chunk_response_t_def
 
 static inline int xlink_upgrade_firmware_chunk_response_send(xlink_context_p context, uint32_t offset, bool accepted)
 {
-    xlink_upgrade_firmware_chunk_response_t msg;
-    msg.offset = offset;
-    msg.accepted = accepted;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_firmware_chunk_response_t *msg = (xlink_upgrade_firmware_chunk_response_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, (uint8_t)sizeof(xlink_upgrade_firmware_chunk_response_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->offset = offset;
+    msg->accepted = accepted;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 typedef xlink_packed(struct xlink_upgrade_finalize_firmware_upgrade_t_def
@@ -133,9 +182,14 @@ typedef xlink_packed(struct xlink_upgrade_finalize_firmware_upgrade_t_def
 
 static inline int xlink_upgrade_finalize_firmware_upgrade_send(xlink_context_p context, uint32_t expected_crc32)
 {
-    xlink_upgrade_finalize_firmware_upgrade_t msg;
-    msg.expected_crc32 = expected_crc32;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_finalize_firmware_upgrade_t *msg = (xlink_upgrade_finalize_firmware_upgrade_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE, (uint8_t)sizeof(xlink_upgrade_finalize_firmware_upgrade_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->expected_crc32 = expected_crc32;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 typedef xlink_packed(struct xlink_upgrade_finalize_firmware_upgrade_response_t_def
@@ -145,9 +199,14 @@ typedef xlink_packed(struct xlink_upgrade_finalize_firmware_upgrade_response_t_d
 
 static inline int xlink_upgrade_finalize_firmware_upgrade_response_send(xlink_context_p context, bool success)
 {
-    xlink_upgrade_finalize_firmware_upgrade_response_t msg;
-    msg.success = success;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE_RESPONSE, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_finalize_firmware_upgrade_response_t *msg = (xlink_upgrade_finalize_firmware_upgrade_response_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FINALIZE_FIRMWARE_UPGRADE_RESPONSE, (uint8_t)sizeof(xlink_upgrade_finalize_firmware_upgrade_response_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->success = success;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 typedef xlink_packed(struct xlink_upgrade_restart_device_t_def
@@ -157,9 +216,256 @@ typedef xlink_packed(struct xlink_upgrade_restart_device_t_def
 
 static inline int xlink_upgrade_restart_device_send(xlink_context_p context, bool success)
 {
-    xlink_upgrade_restart_device_t msg;
-    msg.success = success;
-    return xlink_send(context, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_RESTART_DEVICE, (const uint8_t *)&msg, (uint8_t)sizeof(msg));
+    xlink_frame_t *frame;
+    xlink_upgrade_restart_device_t *msg = (xlink_upgrade_restart_device_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_RESTART_DEVICE, (uint8_t)sizeof(xlink_upgrade_restart_device_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->success = success;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_get_page_digests_t_def
+{
+    uint32_t start_address;
+    uint8_t page_count;
+}) xlink_upgrade_get_page_digests_t;
+
+static inline int xlink_upgrade_get_page_digests_send(xlink_context_p context, uint32_t start_address, uint8_t page_count)
+{
+    xlink_frame_t *frame;
+    xlink_upgrade_get_page_digests_t *msg = (xlink_upgrade_get_page_digests_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_GET_PAGE_DIGESTS, (uint8_t)sizeof(xlink_upgrade_get_page_digests_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->start_address = start_address;
+    msg->page_count = page_count;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_page_digests_t_def
+{
+    uint32_t start_address;
+    uint8_t page_count;
+    uint32_t digests[60];
+}) xlink_upgrade_page_digests_t;
+
+static inline int xlink_upgrade_page_digests_send(xlink_context_p context, uint32_t start_address, uint8_t page_count, const uint32_t *digests)
+{
+    xlink_frame_t *frame;
+    if (digests == NULL)
+    {
+        return -1;
+    }
+    xlink_upgrade_page_digests_t *msg = (xlink_upgrade_page_digests_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_PAGE_DIGESTS, (uint8_t)sizeof(xlink_upgrade_page_digests_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->start_address = start_address;
+    msg->page_count = page_count;
+    memcpy(msg->digests, digests, sizeof(msg->digests[0]) * 60u);
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_set_baudrate_t_def
+{
+    uint32_t baudrate;
+    uint16_t confirm_timeout_ms;
+}) xlink_upgrade_set_baudrate_t;
+
+static inline int xlink_upgrade_set_baudrate_send(xlink_context_p context, uint32_t baudrate, uint16_t confirm_timeout_ms)
+{
+    xlink_frame_t *frame;
+    xlink_upgrade_set_baudrate_t *msg = (xlink_upgrade_set_baudrate_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_SET_BAUDRATE, (uint8_t)sizeof(xlink_upgrade_set_baudrate_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->baudrate = baudrate;
+    msg->confirm_timeout_ms = confirm_timeout_ms;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_set_baudrate_response_t_def
+{
+    uint32_t baudrate;
+    bool accepted;
+}) xlink_upgrade_set_baudrate_response_t;
+
+static inline int xlink_upgrade_set_baudrate_response_send(xlink_context_p context, uint32_t baudrate, bool accepted)
+{
+    xlink_frame_t *frame;
+    xlink_upgrade_set_baudrate_response_t *msg = (xlink_upgrade_set_baudrate_response_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_SET_BAUDRATE_RESPONSE, (uint8_t)sizeof(xlink_upgrade_set_baudrate_response_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->baudrate = baudrate;
+    msg->accepted = accepted;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_confirm_baudrate_t_def
+{
+    uint32_t baudrate;
+}) xlink_upgrade_confirm_baudrate_t;
+
+static inline int xlink_upgrade_confirm_baudrate_send(xlink_context_p context, uint32_t baudrate)
+{
+    xlink_frame_t *frame;
+    xlink_upgrade_confirm_baudrate_t *msg = (xlink_upgrade_confirm_baudrate_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_CONFIRM_BAUDRATE, (uint8_t)sizeof(xlink_upgrade_confirm_baudrate_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->baudrate = baudrate;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_baudrate_confirmed_t_def
+{
+    uint32_t baudrate;
+}) xlink_upgrade_baudrate_confirmed_t;
+
+static inline int xlink_upgrade_baudrate_confirmed_send(xlink_context_p context, uint32_t baudrate)
+{
+    xlink_frame_t *frame;
+    xlink_upgrade_baudrate_confirmed_t *msg = (xlink_upgrade_baudrate_confirmed_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_BAUDRATE_CONFIRMED, (uint8_t)sizeof(xlink_upgrade_baudrate_confirmed_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->baudrate = baudrate;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_get_session_progress_t_def
+{
+    uint32_t session_id;
+}) xlink_upgrade_get_session_progress_t;
+
+static inline int xlink_upgrade_get_session_progress_send(xlink_context_p context, uint32_t session_id)
+{
+    xlink_frame_t *frame;
+    xlink_upgrade_get_session_progress_t *msg = (xlink_upgrade_get_session_progress_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_GET_SESSION_PROGRESS, (uint8_t)sizeof(xlink_upgrade_get_session_progress_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->session_id = session_id;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_session_progress_t_def
+{
+    uint32_t session_id;
+    uint32_t start_address;
+    uint32_t size_bytes;
+    uint8_t page_count;
+    uint8_t written[16];
+}) xlink_upgrade_session_progress_t;
+
+static inline int xlink_upgrade_session_progress_send(xlink_context_p context, uint32_t session_id, uint32_t start_address, uint32_t size_bytes, uint8_t page_count, const uint8_t *written)
+{
+    xlink_frame_t *frame;
+    if (written == NULL)
+    {
+        return -1;
+    }
+    xlink_upgrade_session_progress_t *msg = (xlink_upgrade_session_progress_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_SESSION_PROGRESS, (uint8_t)sizeof(xlink_upgrade_session_progress_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->session_id = session_id;
+    msg->start_address = start_address;
+    msg->size_bytes = size_bytes;
+    msg->page_count = page_count;
+    memcpy(msg->written, written, sizeof(msg->written[0]) * 16u);
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_get_device_inventory_t_def
+{
+    uint8_t reserved;
+}) xlink_upgrade_get_device_inventory_t;
+
+static inline int xlink_upgrade_get_device_inventory_send(xlink_context_p context, uint8_t reserved)
+{
+    xlink_frame_t *frame;
+    xlink_upgrade_get_device_inventory_t *msg = (xlink_upgrade_get_device_inventory_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_GET_DEVICE_INVENTORY, (uint8_t)sizeof(xlink_upgrade_get_device_inventory_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->reserved = reserved;
+    return xlink_frame_finish(context, frame, NULL, 0);
+}
+
+typedef xlink_packed(struct xlink_upgrade_device_inventory_t_def
+{
+    xlink_partition_type_t active_partition;
+    uint32_t current_base_address;
+    uint32_t partition_address[3];
+    uint32_t partition_size[3];
+    uint32_t version[3];
+    uint32_t size_bytes[3];
+    uint32_t commit_hash[3];
+    uint32_t compile_timestamp[3];
+    uint8_t max_chunk_size;
+    uint8_t window;
+    xlink_upgrade_flag_t capabilities;
+    uint32_t max_baudrate;
+}) xlink_upgrade_device_inventory_t;
+
+static inline int xlink_upgrade_device_inventory_send(xlink_context_p context, xlink_partition_type_t active_partition, uint32_t current_base_address, const uint32_t *partition_address, const uint32_t *partition_size, const uint32_t *version, const uint32_t *size_bytes, const uint32_t *commit_hash, const uint32_t *compile_timestamp, uint8_t max_chunk_size, uint8_t window, xlink_upgrade_flag_t capabilities, uint32_t max_baudrate)
+{
+    xlink_frame_t *frame;
+    if (partition_address == NULL)
+    {
+        return -1;
+    }
+    if (partition_size == NULL)
+    {
+        return -1;
+    }
+    if (version == NULL)
+    {
+        return -1;
+    }
+    if (size_bytes == NULL)
+    {
+        return -1;
+    }
+    if (commit_hash == NULL)
+    {
+        return -1;
+    }
+    if (compile_timestamp == NULL)
+    {
+        return -1;
+    }
+    xlink_upgrade_device_inventory_t *msg = (xlink_upgrade_device_inventory_t *)xlink_frame_prepare(context, &frame, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_DEVICE_INVENTORY, (uint8_t)sizeof(xlink_upgrade_device_inventory_t));
+    if (msg == NULL)
+    {
+        return -1;
+    }
+    msg->active_partition = active_partition;
+    msg->current_base_address = current_base_address;
+    memcpy(msg->partition_address, partition_address, sizeof(msg->partition_address[0]) * 3u);
+    memcpy(msg->partition_size, partition_size, sizeof(msg->partition_size[0]) * 3u);
+    memcpy(msg->version, version, sizeof(msg->version[0]) * 3u);
+    memcpy(msg->size_bytes, size_bytes, sizeof(msg->size_bytes[0]) * 3u);
+    memcpy(msg->commit_hash, commit_hash, sizeof(msg->commit_hash[0]) * 3u);
+    memcpy(msg->compile_timestamp, compile_timestamp, sizeof(msg->compile_timestamp[0]) * 3u);
+    msg->max_chunk_size = max_chunk_size;
+    msg->window = window;
+    msg->capabilities = capabilities;
+    msg->max_baudrate = max_baudrate;
+    return xlink_frame_finish(context, frame, NULL, 0);
 }
 
 #endif // XLINK_UPGRADE_H
@@ -0,0 +1,362 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "xlink.h"
+#include "xlink_port_stdlib.h"
+#include "xlink_upgrade.h"
+#define CRC32_SLICING_ALL // build every kernel whatever PARTITION_CRC32_SLICES says
+#include "partition.h"
+#include "crc32_slicing.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycle"
+static inline uint64_t bench_clock(void)
+{
+    return __rdtsc();
+}
+#else
+#define BENCH_UNIT "ns"
+static inline uint64_t bench_clock(void)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+#endif
+
+using namespace std;
+
+static vector<uint8_t> wire;
+
+static xlink_frame_t *bench_frame_alloc(void *transport_handle, uint16_t needed)
+{
+    (void)transport_handle;
+    xlink_frame_t *frame = (xlink_frame_t *)malloc(sizeof(xlink_frame_t));
+    if (frame == NULL)
+    {
+        return NULL;
+    }
+    frame->buffer = (uint8_t *)malloc(needed);
+    if (frame->buffer == NULL)
+    {
+        free(frame);
+        return NULL;
+    }
+    frame->size = needed;
+    return frame;
+}
+
+// frames are appended to the bench stream instead of a serial port
+static int bench_transport_send(void *transport_handle, xlink_frame_t *frame)
+{
+    (void)transport_handle;
+    wire.insert(wire.end(), frame->buffer, frame->buffer + frame->size);
+    free(frame->buffer);
+    free(frame);
+    return 0;
+}
+
+struct rx_stats
+{
+    unsigned long messages;
+    unsigned long payload_sum;
+};
+
+static int bench_chunk_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+{
+    (void)comp_id;
+    (void)msg_id;
+    rx_stats *stats = (rx_stats *)user_data;
+    // kept cheap so the parser dominates the timing
+    stats->messages++;
+    stats->payload_sum += payload_len + (payload_len > 0 ? payload[payload_len - 1] : 0);
+    return 0;
+}
+
+static void usage(void)
+{
+    printf(
+        "Usage: xlink_bench [-n frames] [-r rounds]\n"
+        "-h, --help             display this help and exit\n"
+        "-n, --frames           firmware chunk frames in the stream, default 2000\n"
+        "-r, --rounds           runs per case, the fastest is reported, default 20\n"
+        "Benchmarks the xlink receive parsers, handler dispatch and the CRC16/CRC32 kernels.\n");
+}
+
+static int bench_crc(unsigned rounds);
+
+static int bench_dispatch(unsigned rounds);
+
+// runs fn rounds times and prints the fastest run as items per BENCH_UNIT
+static void bench(const char *name, size_t items, const char *item, unsigned rounds, const function<void(void)> &fn)
+{
+    uint64_t best = UINT64_MAX;
+    for (unsigned i = 0; i < rounds; i++)
+    {
+        uint64_t begin = bench_clock();
+        fn();
+        uint64_t elapsed = bench_clock() - begin;
+        best = elapsed < best ? elapsed : best;
+    }
+    printf("%-32s %8.3f %ss/%s %8.2f %ss/%s\n",
+           name, (double)items / (double)best, item, BENCH_UNIT, (double)best / (double)items, BENCH_UNIT, item);
+}
+
+int main(int argc, char *const *argv)
+{
+    static xlink_port_api_t port = {
+        .malloc_fn = xlink_stdlib_malloc,
+        .free_fn = xlink_stdlib_free,
+        .mutex_create_fn = NULL,
+        .mutex_delete_fn = NULL,
+        .mutex_lock_fn = NULL,
+        .mutex_unlock_fn = NULL,
+        .transport_send_fn = bench_transport_send,
+        .frame_send_alloc_fn = bench_frame_alloc,
+    };
+
+    static const char short_options[] = "hn:r:";
+    static struct option long_options[] = {
+        {"help", 0, 0, 'h'},
+        {"frames", 1, 0, 'n'},
+        {"rounds", 1, 0, 'r'},
+        {0, 0, 0, 0}};
+
+    int c;
+    int option_index = 0;
+    unsigned long frames = 2000;
+    unsigned rounds = 20;
+
+    while ((c = getopt_long(argc, argv, short_options, long_options, &option_index)) != -1)
+    {
+        switch (c)
+        {
+        case 'h':
+            usage();
+            return 0;
+        case 'n':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+            return -1;
+        }
+    }
+    rounds = rounds > 0 ? rounds : 1;
+
+    xlink_context_p ctx = xlink_context_create(&port, NULL);
+    if (ctx == NULL)
+    {
+        printf("xlink context create failed\n");
+        return 1;
+    }
+
+    // full size firmware chunks as sent by the upgrade tool, with a little line noise in between
+    srand(1);
+    uint8_t data[XLINK_UPGRADE_FIRMWARE_CHUNK_DATA_MAX_LEN];
+    for (unsigned long i = 0; i < frames; i++)
+    {
+        for (size_t j = 0; j < sizeof(data); j++)
+        {
+            data[j] = (uint8_t)rand();
+        }
+        xlink_upgrade_firmware_chunk_send(ctx, (uint32_t)i, data, (uint8_t)sizeof(data));
+        if (i % 16 == 0)
+        {
+            wire.push_back(0x00);
+            wire.push_back(0x55);
+        }
+    }
+
+    rx_stats stats;
+    xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK, bench_chunk_cb, &stats);
+
+    printf("stream: %zu bytes, %lu frames, best of %u rounds\n", wire.size(), frames, rounds);
+
+    rx_stats byte_stats = {0, 0};
+    bench("xlink_process_rx", wire.size(), "byte", rounds, [&]()
+          {
+        stats = {0, 0};
+        for (size_t i = 0; i < wire.size(); i++)
+        {
+            xlink_process_rx(ctx, wire[i]);
+        }
+        byte_stats = stats; });
+
+    const size_t block_sizes[] = {256, 270, 4096};
+    for (size_t block : block_sizes)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "xlink_process_rx_buffer/%zu", block);
+        bench(name, wire.size(), "byte", rounds, [&]()
+              {
+            stats = {0, 0};
+            for (size_t pos = 0; pos < wire.size(); pos += block)
+            {
+                size_t len = wire.size() - pos < block ? wire.size() - pos : block;
+                xlink_process_rx_buffer(ctx, &wire[pos], len);
+            } });
+        if (stats.messages != byte_stats.messages || stats.payload_sum != byte_stats.payload_sum)
+        {
+            printf("MISMATCH: %lu messages (sum %lu), byte parser got %lu (sum %lu)\n",
+                   stats.messages, stats.payload_sum, byte_stats.messages, byte_stats.payload_sum);
+            xlink_context_delete(ctx);
+            return 1;
+        }
+    }
+    printf("parsers agree on %lu messages\n", byte_stats.messages);
+
+    xlink_context_delete(ctx);
+    if (bench_dispatch(rounds) != 0)
+    {
+        return 1;
+    }
+    return bench_crc(rounds);
+}
+
+static int bench_count_cb(uint8_t comp_id, uint8_t msg_id, const uint8_t *payload, uint8_t payload_len, void *user_data)
+{
+    (void)comp_id;
+    (void)msg_id;
+    (void)payload;
+    (void)payload_len;
+    (*(unsigned long *)user_data)++;
+    return 0;
+}
+
+// handler lookup with one and with every component row in use, plus register/unregister churn
+static int bench_dispatch(unsigned rounds)
+{
+    const unsigned long messages = 20000;
+    const uint8_t target_comp = 0xF0;
+    const uint8_t target_msg = XLINK_MAX_MSG_IDS - 1;
+    xlink_port_api_t port = {
+        .malloc_fn = xlink_stdlib_malloc,
+        .free_fn = xlink_stdlib_free,
+        .mutex_create_fn = NULL,
+        .mutex_delete_fn = NULL,
+        .mutex_lock_fn = NULL,
+        .mutex_unlock_fn = NULL,
+        .transport_send_fn = bench_transport_send,
+        .frame_send_alloc_fn = bench_frame_alloc,
+    };
+
+    xlink_context_p ctx = xlink_context_create(&port, NULL);
+    if (ctx == NULL)
+    {
+        return 1;
+    }
+    wire.clear();
+    for (unsigned long i = 0; i < messages; i++)
+    {
+        xlink_send(ctx, target_comp, target_msg, NULL, 0);
+    }
+    printf("\ndispatch: %lu empty frames to comp 0x%02x msg %u\n", messages, target_comp, target_msg);
+
+    unsigned long count = 0;
+    for (int full = 0; full < 2; full++)
+    {
+        if (full)
+        {
+            // fill every other component row and message id ahead of the target
+            for (uint8_t comp = 0; comp < XLINK_MAX_COMPONENTS - 1; comp++)
+            {
+                for (uint8_t msg = 0; msg < 4; msg++)
+                {
+                    xlink_register_msg_handler(ctx, comp, msg, bench_count_cb, &count);
+                }
+            }
+        }
+        else
+        {
+            xlink_register_msg_handler(ctx, target_comp, target_msg, bench_count_cb, &count);
+        }
+        bench(full ? "dispatch, all rows in use" : "dispatch, one component", messages, "msg", rounds, [&]()
+              {
+            count = 0;
+            xlink_process_rx_buffer(ctx, wire.data(), wire.size()); });
+        if (count != messages)
+        {
+            printf("MISMATCH: %lu of %lu messages dispatched\n", count, messages);
+            xlink_context_delete(ctx);
+            return 1;
+        }
+    }
+
+    const unsigned long pairs = 100000;
+    bench("register+unregister", pairs, "pair", rounds, [&]()
+          {
+        for (unsigned long i = 0; i < pairs; i++)
+        {
+            xlink_register_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, bench_count_cb, &count);
+            xlink_unregister_msg_handler(ctx, XLINK_COMP_ID_UPGRADE, XLINK_UPGRADE_MSG_ID_FIRMWARE_CHUNK_RESPONSE, bench_count_cb, &count);
+        } });
+
+    xlink_context_delete(ctx);
+    return 0;
+}
+
+// CRC kernels over one app slot, the size check_app_valid hashes on every boot
+static int bench_crc(unsigned rounds)
+{
+    vector<uint8_t> slot(PARTITION_SIZE_APP_A);
+    for (size_t i = 0; i < slot.size(); i++)
+    {
+        slot[i] = (uint8_t)rand();
+    }
+    printf("\nCRC over %zu bytes, best of %u rounds\n", slot.size(), rounds);
+
+    volatile uint16_t crc16 = 0;
+    bench("xlink_crc16_with_init", slot.size(), "byte", rounds, [&]()
+          {
+        uint16_t crc = XLINK_INIT_CRC16;
+        for (size_t pos = 0; pos < slot.size(); pos += 0x8000)
+        {
+            size_t len = slot.size() - pos < 0x8000 ? slot.size() - pos : 0x8000;
+            crc = xlink_crc16_with_init(&slot[pos], (uint16_t)len, crc);
+        }
+        crc16 = crc; });
+    (void)crc16;
+
+    uint32_t expected = 0;
+    uint32_t result = 0;
+    bench("crc32_update", slot.size(), "byte", rounds, [&]()
+          { expected = crc32_update(slot.data(), slot.size(), 0); });
+
+    struct
+    {
+        const char *name;
+        uint32_t (*kernel)(const uint8_t *buf, size_t size, uint32_t crc);
+    } kernels[] = {
+        {"crc32_update_slice4", crc32_update_slice4},
+        {"crc32_update_slice8", crc32_update_slice8},
+    };
+    for (auto &k : kernels)
+    {
+        bench(k.name, slot.size(), "byte", rounds, [&]()
+              { result = k.kernel(slot.data(), slot.size(), 0); });
+        // odd lengths and offsets exercise the byte tail
+        bool exact = result == expected;
+        for (size_t len = 0; len < 64 && exact; len++)
+        {
+            exact = k.kernel(&slot[len % 7], len, 0x12345678) == crc32_update(&slot[len % 7], len, 0x12345678);
+        }
+        if (!exact)
+        {
+            printf("MISMATCH: %s differs from crc32_update\n", k.name);
+            return 1;
+        }
+    }
+    printf("CRC32 kernels agree: 0x%08x\n", expected ^ 0xFFFFFFFF);
+    return 0;
+}